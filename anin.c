@@ -26,14 +26,143 @@
 #include "utility.h"
 #include "anin.h"
 #include "pio.h"
+#include "timers.h"
+#include "crc_api.h"
+#include "fls_api.h"
 
-static uint16_t anin_av  [ADC_CHANNELS];   /* Copy of averaged readings.   */
-static uint32_t anin_acum[ADC_CHANNELS];   /* Accumulation for averages.   */
+static uint16_t anin_av  [ADC_CHANNELS];   /* Copy of filtered readings.   */
+static uint16_t anin_sum [ADC_CHANNELS];   /* Sums of ANIN_SUM_N readings. */
+static uint32_t anin_iir [ADC_CHANNELS];   /* IIR on the sums.             */
 static uint16_t amux_av  [AMUX_CHANNELS];
-static uint32_t amux_acum[AMUX_CHANNELS];
+static uint16_t amux_sum [AMUX_CHANNELS];
+static uint32_t amux_iir [AMUX_CHANNELS];
+static int32_t  probe_dm [2];               /* Probe 1, 2 high less low.    */
 static uint16_t sequence_counter;           /* Sequence counter.            */
 static uint16_t overflows;
 
+/*-- Filtering.  Each channel's readings are summed in 16s (a moving sum    */
+/*   decimator, 16 12 bit readings just fit a uint16_t), and each sum goes  */
+/*   through a first order IIR, y += sum - y / 2^k.  One channel's sum is   */
+/*   filtered a tick, round them all every 16 ticks, so readings are fresh  */
+/*   every 10ms, (the multiplexed inputs 80ms as they are read less often). */
+/*   A step is 63% through in 2^k sums.  Noise is as a boxcar average of    */
+/*   2^(k + 5) readings, so k = 3 matches the old 256 reading averages.     */
+/*   A probe's sum is its 16 readings excited less its 16 not, (see         */
+/*   anin_tirq), so k = 4 matches the old 256 excited readings for noise.   */
+#define ANIN_SUM_SHIFT  (4)
+#define ANIN_SUM_N      (1 << ANIN_SUM_SHIFT)
+
+/*   k is fixed for each group of channels, so the IIR's 32 bit shifts   */
+/*   are constant, (inline RRC pairs, no variable shift library loop).   */
+#define ANIN_K_PROBE    (4)     /* ADC_PROBE1, ADC_PROBE2.              */
+#define ANIN_K_CPU_TEMP (5)     /* ADC_CPU_TEMP.                        */
+#define ANIN_K_ADC      (3)     /* Other ADC channels.                  */
+#define AMUX_K_CURRENT  (1)     /* Multiplexed pump / solenoid currents.*/
+#define AMUX_K_SUPPLY   (3)     /* Multiplexed supply voltages.         */
+
+#define AMUX_CURRENTS   ((1 << AMUX_POLISH_CURRENT) | \
+                         (1 << AMUX_CONDENSATE_CURRENT) | \
+                         (1 << AMUX_FILL_CURRENT) | \
+                         (1 << AMUX_PURGE_CURRENT) | \
+                         (1 << AMUX_BOOST_CURRENT))
+
+/*-- anin_tirq bumps anin_av_gen each time it updates the averages.  The  */
+/*   main line copies the averages and checks the count did not move, so */
+/*   it always gets a consistent set without turning interrupts off.     */
+static volatile uint8_t anin_av_gen;
+
+/*-- Calibration, (WTS_DADR_ANIN_CAL).  Kept in INFOA with its CRC, and   */
+/*   copied to RAM by anin_init, which uses the defaults if it is bad.    */
+/*   ADC channels first, then the multiplexed ones.                       */
+#if WTS_CAL_CHANNELS != ADC_CHANNELS + AMUX_CHANNELS
+#error Calibration channels do not match WTS_DADR_ANIN_CAL
+#endif
+#define ANIN_CAL_SEG    (0x1080)        /* INFOA.                       */
+
+struct anin_cal_rec {
+    struct comms_anin_cal cal;
+    uint16_t crc;
+};
+#define anin_cal_stored ((const struct anin_cal_rec *)ANIN_CAL_SEG)
+
+static struct comms_anin_cal anin_cal;
+static uint8_t anin_cal_state;          /* WTS_CAL_xxx.                 */
+
+/*-- Engineering units, (anin_rd_to_eu).  The tables are for the front    */
+/*   ends below, and are interpolated linearly between their points.      */
+/*   These front ends are ASSUMED, not yet checked against the board      */
+/*   schematics, so the readings go out flagged WTS_EU_UNCONFIRMED.       */
+/*   Take it out of ANIN_EU_FLAGS once the tables are confirmed.          */
+#define ANIN_EU_FLAGS       (WTS_EU_UNCONFIRMED)
+
+/*   Probe temperature: 10k NTC (B 3977K) to 0V, 10k to the reference.    */
+/*   0.01 degC each 256 counts.                                           */
+#define ANIN_EU_TEMP_SHIFT  (8)
+static const int16_t anin_eu_temp[(4096 >> ANIN_EU_TEMP_SHIFT) + 1] = {
+     15000,  10095,   7592,   6182,   5176,   4373,   3687,   3073,
+      2500,   1949,   1400,    836,    231,   -453,  -1296,  -2532,
+     -4000
+};
+
+/*   Probe conductivity: cell (K = 0.1/cm) to 0V, 10k to the excitation.   */
+/*   0.01 uS/cm each 128 counts, saturating at 327.67 uS/cm.              */
+#define ANIN_EU_COND_SHIFT  (7)
+static const int16_t anin_eu_cond[(4096 >> ANIN_EU_COND_SHIFT) + 1] = {
+     32767,  31000,  15000,   9667,   7000,   5400,   4333,   3571,
+      3000,   2556,   2200,   1909,   1667,   1462,   1286,   1133,
+      1000,    882,    778,    684,    600,    524,    455,    391,
+       333,    280,    231,    185,    143,    103,     67,     32,
+         0
+};
+
+/*   Conductivity at 25 degC over that at T, 1 / (1 + 0.02(T - 25)), Q13, */
+/*   each 5.12 degC from 0 degC.                                          */
+#define ANIN_EU_COMP_SHIFT  (9)
+#define ANIN_EU_COMP_MAX    (8191)      /* 0.01 degC.                   */
+static const int16_t anin_eu_comp[(8192 >> ANIN_EU_COMP_SHIFT) + 1] = {
+     16384,  13599,  11623,  10149,   9006,   8095,   7351,   6732,
+      6210,   5763,   5375,   5037,   4739,   4474,   4237,   4024,
+      3831
+};
+
+/*   Supplies and currents are linear, mV or mA at 4096 counts, from the  */
+/*   divider and current sense gain on each.  (VCC is the ADC12's own     */
+/*   VCC / 2.)                                                            */
+#define ANIN_EU_VCC_FS      (5000)
+static const uint16_t amux_eu_fs[AMUX_CHANNELS] = {
+    27500,  /* AMUX_24V,                1 / 11      */
+    2500,   /* AMUX_POLISH_CURRENT,     1V / A      */
+    2500,   /* AMUX_CONDENSATE_CURRENT  */
+    7500,   /* AMUX_5V,                 1 / 3       */
+    2500,   /* AMUX_1V2,                direct      */
+    2500,   /* AMUX_FILL_CURRENT        */
+    2500,   /* AMUX_PURGE_CURRENT       */
+    2500    /* AMUX_BOOST_CURRENT       */
+};
+
+/*-- Raw waveform capture.  The ring buffer holds whole sample sets, so   */
+/*   its length depends on the number of channels.                        */
+static uint16_t cap_buf[ANIN_CAP_SAMPLES];
+static struct {
+    volatile uint8_t state;     /* WTS_CAP_STATE_xxx.                   */
+    uint8_t  nchan;             /* Channels per sample set.             */
+    uint8_t  chan[ADC_CHANNELS + 1];/* ADC12MEMx index of each.         */
+    uint8_t  trig_chan;
+    uint8_t  trig_mode;
+    uint16_t trig_level;
+    uint16_t trig_prev;         /* Last sample of trigger channel.      */
+    uint16_t chan_mask;
+    uint16_t len;               /* Ring length in samples.              */
+    uint16_t idx;               /* Next sample goes here.               */
+    uint16_t count;             /* Samples in ring, up to len.          */
+    uint16_t post_sets;         /* As configured.                       */
+    uint16_t post_left;         /* Sets still to take after trigger.    */
+    uint16_t last_seq;          /* Sequence count of final set.         */
+} cap;
+
+/*-- ADC12MEM0 to ADC12MEM15 are consecutive registers. */
+#define ADC_MEM(n)  ((&ADC12MEM0)[n])
+
 /*-- Macro magic to turn a channel number into a register name. */
 /*   ADC_CHNL(ADC_PROBE1) should become ADC12MEM0               */
 #define __CAT__(x,y) x##y
@@ -43,6 +172,121 @@ static uint16_t overflows;
 /*-- Use same ID to give interrpt mask. */
 #define ADC12IE_MSK(x) (1<<x)
 
+/*-- Each conversion sequence is started by the rising edge of Timer A    */
+/*   OUT1, set by the TACCR1 compare, so the readings are taken on the    */
+/*   timer clock whatever the interrupt latency.  Drive OUT1 low, and     */
+/*   have the next compare set it.  (The ADC wants ENC toggled between    */
+/*   sequences started this way, as well.)                                */
+#define ANIN_TRIG_ARM() do{                                     \
+        TACCTL1 = OUTMOD_0;         /* OUT1 low.                */  \
+        TACCTL1 = OUTMOD_1;         /* Set at TACCR1, no irq.   */  \
+    }while(0)
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cal_valid
+ *  FUNCTIONAL DESCRIPTION: Check a calibration can be applied by
+ *                          anin_cal_apply without overflow.
+ *  FORMAL PARAMETERS:      cal : Calibration to check.
+ *  RETURN VALUE:           NZ if all the offsets are in range.
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static uint8_t anin_cal_valid(const struct comms_anin_cal *cal)
+{
+    uint8_t i;
+
+    for(i = 0; i < WTS_CAL_CHANNELS; i++){
+        if(cal->chan[i].offset > WTS_CAL_OFFSET_MAX ||
+           cal->chan[i].offset < -WTS_CAL_OFFSET_MAX){
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cal_load
+ *  FUNCTIONAL DESCRIPTION: Copy the calibration from INFOA, or use the
+ *                          defaults if its CRC is bad, (or it is blank),
+ *                          or it is out of range.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void anin_cal_load(void)
+{
+    uint8_t i;
+
+    if(gsebus_crc_isInvalid((void *)anin_cal_stored,
+                            sizeof(struct anin_cal_rec) - crc_overhead) ||
+       !anin_cal_valid(&anin_cal_stored->cal)){
+        for(i = 0; i < WTS_CAL_CHANNELS; i++){
+            anin_cal.chan[i].offset = 0;
+            anin_cal.chan[i].gain   = WTS_CAL_GAIN_ONE;
+        }
+        anin_cal_state = WTS_CAL_NONE;
+    } else {
+        memcpy(&anin_cal, &anin_cal_stored->cal, sizeof(anin_cal));
+        anin_cal_state = WTS_CAL_STORED;
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cal_write
+ *  FUNCTIONAL DESCRIPTION: Store a new calibration in INFOA, and use it.
+ *  FORMAL PARAMETERS:      cal : Calibration from the CCP, (word
+ *                                aligned, written to flash as it is).
+ *  RETURN VALUE:           Z if OK, else WTS_ERR_CAL_RANGE or
+ *                          WTS_ERR_CAL_WRFAIL.
+ *  SIDE EFFECTS:           Erases INFOA, (~11ms, with the CPU stalled).
+ ******************************************************************************
+ */
+uint8_t anin_cal_write(const struct comms_anin_cal *cal)
+{
+    uint16_t crc;
+
+    if(!anin_cal_valid(cal)){
+        return WTS_ERR_CAL_RANGE;       /* Old calibration kept.        */
+    }
+    /*-- Record is the calibration then its CRC, (struct anin_cal_rec). */
+    crc = gsebus_crc_calc(cal, sizeof(*cal));
+    fls_erase((const uint16_t *)ANIN_CAL_SEG);
+    fls_write((const uint16_t *)&anin_cal_stored->cal, (void *)cal,
+              sizeof(*cal) / sizeof(uint16_t));
+    fls_write(&anin_cal_stored->crc, &crc, 1);
+    if(memcmp(&anin_cal_stored->cal, cal, sizeof(*cal)) != 0 ||
+       anin_cal_stored->crc != crc){
+        anin_cal_load();                /* Whatever is there now.       */
+        return WTS_ERR_CAL_WRFAIL;
+    }
+    __disable_interrupt();              /* Not part way through a       */
+    memcpy(&anin_cal, cal, sizeof(anin_cal));   /* channel.             */
+    anin_cal_state = WTS_CAL_STORED;
+    __enable_interrupt();
+    return 0;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cal_get
+ *  FUNCTIONAL DESCRIPTION: Give the calibration in use.
+ *  FORMAL PARAMETERS:      cal : Set to point at it.
+ *  RETURN VALUE:           WTS_CAL_xxx.
+ *  SIDE EFFECTS:           None 
+ *  Notes:                  Only anin_cal_write changes it, so it can be
+ *                          read from the main line without a copy.
+ ******************************************************************************
+ */
+uint8_t anin_cal_get(const struct comms_anin_cal **cal)
+{
+    *cal = &anin_cal;
+    return anin_cal_state;
+}
+
 /*
  ******************************************************************************
  *  FUNCTION NAME:          anin_init
@@ -56,6 +300,7 @@ static uint16_t overflows;
 void anin_init(void)
 {
     memset(anin_av, 0, sizeof(anin_av));
+    anin_cal_load();
     
     /*-- Set up ADC */
     /*
@@ -68,9 +313,10 @@ void anin_init(void)
     /*
      * > When conversions are started the sequence starts at ADC ctrl/mem idx 0
      * > ADC does one conversion sequence then stops.
+     * > Sequence started by the rising edge of Timer A OUT1, (TACCR1 compare).
      * > SMCK / 8 selected as clock source for ADC.
      */
-    ADC12CTL1 = CONSEQ_1 | ADC12SSEL_3 | ADC12DIV_7 | SHP;
+    ADC12CTL1 = CONSEQ_1 | SHS_1 | ADC12SSEL_3 | ADC12DIV_7 | SHP;
 
     /*
      * Define conversion sequence.
@@ -84,22 +330,29 @@ void anin_init(void)
     ADC12MCTL5 = SREF_5|INCH_WATER;
     ADC12MCTL6 = SREF_5|INCH_CPU_TEMP;
     ADC12MCTL7 = SREF_5|INCH_VCC;
-    ADC12MCTL8 = SREF_5|INCH_MUX       | EOS;
+    ADC12MCTL8 = SREF_5|INCH_MUX;
+    ADC12MCTL9 = SREF_5|INCH_PROBE1;
+    ADC12MCTL10= SREF_5|INCH_PROBE2    | EOS;
     
     ADC12CTL0 |= ENC;               /* Enable ADC converter.        */
 
     /*
-     * Enable interrupt for external multiplexer conversion complete.
+     * Enable interrupt for conversion sequence complete.
      */
-    ADC12IE = ADC12IE_MSK(ADC_MUX);
+    ADC12IE = ADC12IE_MSK(ADC_PROBE2_B);
+
+    /*
+     * Start sampling, the first compare sets OUT1.  The end of sequence
+     * interrupt clears it again ready for the next.
+     */
+    TACCR1  = TAR + CONDUCTIVITY_METER_IRQ_PERIOD;
+    ANIN_TRIG_ARM();
 }
 
 /*
  ******************************************************************************
  *  FUNCTION NAME:          anin_state_machine
- *  FUNCTIONAL DESCRIPTION: If averages are
- *                          Once 256 readings are accumulated transfer the
- *                          averages across.
+ *  FUNCTIONAL DESCRIPTION: Nothing, the readings are filtered by anin_tirq.
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           None 
@@ -110,6 +363,27 @@ void anin_state_machine(void)
     /*-- This code was moved to the interrupt. */
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_av_copy
+ *  FUNCTIONAL DESCRIPTION: Take a consistent copy of the filtered readings.
+ *  FORMAL PARAMETERS:      av     : ADC_CHANNELS readings.
+ *                          mux_av : AMUX_CHANNELS readings.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void anin_av_copy(uint16_t *av, uint16_t *mux_av)
+{
+    uint8_t gen;
+
+    do{                                 /* Retry if anin_tirq got in.   */
+        gen = anin_av_gen;
+        memcpy(av, anin_av, sizeof(anin_av));
+        memcpy(mux_av, amux_av, sizeof(amux_av));
+    } while(gen != anin_av_gen);
+}
+
 /*
  ******************************************************************************
  *  FUNCTION NAME:          anin_rd_to_comms
@@ -121,38 +395,384 @@ void anin_state_machine(void)
  */
 void anin_rd_to_comms(struct comms_wts_status *cm_st)
 {
+    uint16_t av[ADC_CHANNELS];
+    uint16_t mux_av[AMUX_CHANNELS];
+
+    anin_av_copy(av, mux_av);
+
     cm_st->anin_filt_overflows      = overflows;
     cm_st->cpu_temperature = 
-        ((int32_t)anin_av[ADC_CPU_TEMP]-1614)*70400L/4095;
-    cm_st->anin_probe1_conductivity = anin_av[ADC_PROBE1];
-    cm_st->anin_probe1_temperature  = anin_av[ADC_PROBE1_TEMP];
-    cm_st->anin_probe2_conductivity = anin_av[ADC_PROBE2];
-    cm_st->anin_probe2_temperature  = anin_av[ADC_PROBE2_TEMP];
-    cm_st->anin_spare1              = anin_av[ADC_SPARE1];
-    cm_st->anin_water_meter         = anin_av[ADC_WATER];
-    cm_st->anin_3V6                 = anin_av[ADC_VCC];
+        ((int32_t)av[ADC_CPU_TEMP]-1614)*70400L/4095;
+    cm_st->anin_probe1_conductivity = av[ADC_PROBE1];
+    cm_st->anin_probe1_temperature  = av[ADC_PROBE1_TEMP];
+    cm_st->anin_probe2_conductivity = av[ADC_PROBE2];
+    cm_st->anin_probe2_temperature  = av[ADC_PROBE2_TEMP];
+    cm_st->anin_spare1              = av[ADC_SPARE1];
+    cm_st->anin_water_meter         = av[ADC_WATER];
+    cm_st->anin_3V6                 = av[ADC_VCC];
     cm_st->resurved                 = 0xffff;
 
-    cm_st->anin_24V                 = amux_av[AMUX_24V];
-    cm_st->anin_polish_current      = amux_av[AMUX_POLISH_CURRENT];
-    cm_st->anin_condensate_current  = amux_av[AMUX_CONDENSATE_CURRENT];
-    cm_st->anin_5V                  = amux_av[AMUX_5V];
-    cm_st->anin_1V2                 = amux_av[AMUX_1V2];
-    cm_st->anin_fill_current        = amux_av[AMUX_FILL_CURRENT];
-    cm_st->anin_purge_current       = amux_av[AMUX_PURGE_CURRENT];
-    cm_st->anin_boost_current       = amux_av[AMUX_BOOST_CURRENT];
+    cm_st->anin_24V                 = mux_av[AMUX_24V];
+    cm_st->anin_polish_current      = mux_av[AMUX_POLISH_CURRENT];
+    cm_st->anin_condensate_current  = mux_av[AMUX_CONDENSATE_CURRENT];
+    cm_st->anin_5V                  = mux_av[AMUX_5V];
+    cm_st->anin_1V2                 = mux_av[AMUX_1V2];
+    cm_st->anin_fill_current        = mux_av[AMUX_FILL_CURRENT];
+    cm_st->anin_purge_current       = mux_av[AMUX_PURGE_CURRENT];
+    cm_st->anin_boost_current       = mux_av[AMUX_BOOST_CURRENT];
 }
 
 /*
  ******************************************************************************
- *  FUNCTION NAME:          anin_state_machine
- *  FUNCTIONAL DESCRIPTION: Accumulate averages for analogue readings.
- *                          Once 256 readings are accumulated, wait for the
- *                          main line to copy the averages accross.
+ *  FUNCTION NAME:          anin_interp
+ *  FUNCTIONAL DESCRIPTION: Look a reading up in a table, interpolating
+ *                          between its points.
+ *  FORMAL PARAMETERS:      tbl   : Table, a point each 2^shift.
+ *                          shift : Table spacing.
+ *                          x     : Reading, below the last point.
+ *  RETURN VALUE:           Value.
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static int16_t anin_interp(const int16_t *tbl, uint8_t shift, uint16_t x)
+{
+    const int16_t *p = &tbl[x >> shift];
+    int32_t d = (int32_t)(p[1] - p[0]) * (x & ((1 << shift) - 1));
+
+    return p[0] + (int16_t)(d >> shift);
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_probe_eu
+ *  FUNCTIONAL DESCRIPTION: Turn a probe's readings into temperature, and
+ *                          conductivity compensated to 25 degC.
+ *  FORMAL PARAMETERS:      cond : Conductivity reading.
+ *                          temp : Temperature reading.
+ *                          t    : Where to put the temperature, 0.01 degC.
+ *  RETURN VALUE:           Conductivity at 25 degC, 0.01 uS/cm.
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static uint16_t anin_probe_eu(uint16_t cond, uint16_t temp, int16_t *t)
+{
+    int16_t tc;
+    uint32_t c25;
+
+    *t = anin_interp(anin_eu_temp, ANIN_EU_TEMP_SHIFT, temp);
+    tc = (*t < 0)? 0: (*t > ANIN_EU_COMP_MAX)? ANIN_EU_COMP_MAX: *t;
+    c25 = (uint32_t)anin_interp(anin_eu_cond, ANIN_EU_COND_SHIFT, cond) *
+          (uint16_t)anin_interp(anin_eu_comp, ANIN_EU_COMP_SHIFT, tc) >> 13;
+    return (c25 > 0xFFFF)? 0xFFFF: (uint16_t)c25;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_rd_to_eu
+ *  FUNCTIONAL DESCRIPTION: Give the probe, supply and current readings in
+ *                          engineering units.
+ *  FORMAL PARAMETERS:      eu : Filled in.
+ *  RETURN VALUE:           WTS_EU_xxx flags.
+ *  SIDE EFFECTS:           None 
+ *  Notes:                  Four multiplies a probe, and one a supply or
+ *                          current, on the latest filtered readings.
+ ******************************************************************************
+ */
+uint8_t anin_rd_to_eu(struct comms_wts_status_eu *eu)
+{
+    uint16_t av[ADC_CHANNELS];
+    uint16_t mux_av[AMUX_CHANNELS];
+    uint16_t mux_eu[AMUX_CHANNELS];
+    uint8_t i;
+
+    anin_av_copy(av, mux_av);
+
+    eu->probe1_conductivity = anin_probe_eu(av[ADC_PROBE1],
+                                            av[ADC_PROBE1_TEMP],
+                                            &eu->probe1_temperature);
+    eu->probe2_conductivity = anin_probe_eu(av[ADC_PROBE2],
+                                            av[ADC_PROBE2_TEMP],
+                                            &eu->probe2_temperature);
+    eu->supply_3V6 = (uint32_t)av[ADC_VCC] * ANIN_EU_VCC_FS >> 12;
+
+    for(i = 0; i < AMUX_CHANNELS; i++){
+        mux_eu[i] = (uint32_t)mux_av[i] * amux_eu_fs[i] >> 12;
+    }
+    eu->supply_24V          = mux_eu[AMUX_24V];
+    eu->supply_5V           = mux_eu[AMUX_5V];
+    eu->supply_1V2          = mux_eu[AMUX_1V2];
+    eu->polish_current      = mux_eu[AMUX_POLISH_CURRENT];
+    eu->condensate_current  = mux_eu[AMUX_CONDENSATE_CURRENT];
+    eu->fill_current        = mux_eu[AMUX_FILL_CURRENT];
+    eu->purge_current       = mux_eu[AMUX_PURGE_CURRENT];
+    eu->boost_current       = mux_eu[AMUX_BOOST_CURRENT];
+    return ANIN_EU_FLAGS;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cap_arm
+ *  FUNCTIONAL DESCRIPTION: Set up and start a raw waveform capture.  Sample
+ *                          sets go round the buffer until the trigger, and
+ *                          then cfg->post_sets more are taken.
+ *  FORMAL PARAMETERS:      cfg : Capture set up from the CCP.
+ *  RETURN VALUE:           Z if OK, else WTS_ERR_CAP_CFG.
+ *  SIDE EFFECTS:           Any earlier capture is lost.
+ ******************************************************************************
+ */
+uint8_t anin_cap_arm(const struct comms_anin_cap_cfg *cfg)
+{
+    uint8_t n, i;
+
+    if(cfg->chan_mask == 0 || cfg->chan_mask >= (1 << (ADC_MUX + 1)) ||
+       cfg->trig_chan > ADC_MUX || cfg->trig_mode > WTS_CAP_TRIG_FALLING){
+        return WTS_ERR_CAP_CFG;
+    }
+    cap.state = WTS_CAP_STATE_IDLE;     /* Keep ISR out while set up.   */
+
+    for(i = 0, n = 0; i <= ADC_MUX; i++){
+        if(cfg->chan_mask & (1 << i)){
+            cap.chan[n++] = i;
+        }
+    }
+    cap.nchan      = n;
+    cap.chan_mask  = cfg->chan_mask;
+    cap.len        = (ANIN_CAP_SAMPLES / n) * n;
+    cap.idx        = 0;
+    cap.count      = 0;
+    cap.post_sets  = cfg->post_sets? cfg->post_sets: 1;
+    cap.post_left  = cap.post_sets;
+    cap.trig_chan  = cfg->trig_chan;
+    cap.trig_mode  = cfg->trig_mode;
+    cap.trig_level = cfg->trig_level;
+    /*-- No trigger until the channel has actually crossed the level. */
+    cap.trig_prev  = (cfg->trig_mode == WTS_CAP_TRIG_RISING)? 0xFFFF: 0;
+
+    cap.state = WTS_CAP_STATE_ARMED;    /* Last, starts the ISR off.    */
+    return 0;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cap_trigger
+ *  FUNCTIONAL DESCRIPTION: Trigger an armed capture now.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+void anin_cap_trigger(void)
+{
+    __disable_interrupt();
+    if(cap.state == WTS_CAP_STATE_ARMED){
+        cap.state = WTS_CAP_STATE_TRIGGERED;
+    }
+    __enable_interrupt();
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cap_stop
+ *  FUNCTIONAL DESCRIPTION: Abandon any capture.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+void anin_cap_stop(void)
+{
+    cap.state = WTS_CAP_STATE_IDLE;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cap_info
+ *  FUNCTIONAL DESCRIPTION: Report capture state, and once done, where the
+ *                          samples are.
+ *  FORMAL PARAMETERS:      info : Filled in.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+void anin_cap_info(struct anin_cap_info *info)
+{
+    uint32_t post;
+
+    info->state     = cap.state;
+    info->chan_mask = cap.chan_mask;
+    if(info->state != WTS_CAP_STATE_DONE){
+        info->samples     = 0;
+        info->trig_offset = 0;
+        info->first_seq   = 0;
+        return;
+    }
+    post = (uint32_t)cap.post_sets * cap.nchan;
+    info->samples     = cap.count;
+    info->first_seq   = cap.last_seq + 1 - cap.count / cap.nchan;
+    if(post > cap.count){                       /* Trigger fell out.    */
+        info->trig_offset = 0;
+    } else {
+        info->trig_offset = cap.count - (uint16_t)post;
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cap_seg
+ *  FUNCTIONAL DESCRIPTION: Find where captured samples are in the ring
+ *                          buffer, oldest first, so they can be sent from
+ *                          it as they are.  Samples either side of the
+ *                          end of the ring take two calls.
+ *  FORMAL PARAMETERS:      offset : First sample wanted.
+ *                          seg    : Set to point at it.
+ *                          max    : Most samples wanted.
+ *  RETURN VALUE:           Number of samples at seg, 0 if none.
+ *  SIDE EFFECTS:           None 
+ *  Notes:                  The ring is left alone once the capture is
+ *                          done, until the next anin_cap_arm.
+ ******************************************************************************
+ */
+uint8_t anin_cap_seg(uint16_t offset, const uint16_t **seg, uint8_t max)
+{
+    uint16_t i;
+
+    if(cap.state != WTS_CAP_STATE_DONE || offset >= cap.count){
+        return 0;
+    }
+    if(cap.count - offset < max){
+        max = cap.count - offset;
+    }
+    /*-- Oldest sample is count back from the write index. */
+    i = cap.idx + cap.len - cap.count + offset;
+    if(i >= cap.len){
+        i -= cap.len;
+    }
+    if(cap.len - i < max){
+        max = cap.len - i;              /* Rest is at the start.        */
+    }
+    *seg = &cap_buf[i];
+    return max;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cap_tirq
+ *  FUNCTIONAL DESCRIPTION: Add the latest sample set to the capture, and
+ *                          look for the trigger.
+ *  FORMAL PARAMETERS:      sc : Sequence count of this sample set.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ *  Notes:                  Called by ADC interrupt, only while armed or
+ *                          triggered.
+ ******************************************************************************
+ */
+static void anin_cap_tirq(uint16_t sc)
+{
+    uint16_t idx = cap.idx;
+    uint8_t i;
+
+    for(i = 0; i < cap.nchan; i++){
+        cap_buf[idx] = ADC_MEM(cap.chan[i]);
+        if(++idx >= cap.len){
+            idx = 0;
+        }
+    }
+    cap.idx = idx;
+    if(cap.count < cap.len){
+        cap.count += cap.nchan;
+    }
+
+    if(cap.state == WTS_CAP_STATE_ARMED){
+        if(cap.trig_mode != WTS_CAP_TRIG_CMD){
+            uint16_t v = ADC_MEM(cap.trig_chan);
+            uint16_t level = cap.trig_level;
+            if(cap.trig_mode == WTS_CAP_TRIG_RISING?
+                    (cap.trig_prev < level && v >= level):
+                    (cap.trig_prev > level && v <= level)){
+                cap.state = WTS_CAP_STATE_TRIGGERED;
+            }
+            cap.trig_prev = v;
+        }
+    } else if(cap.post_left <= 1){      /* Triggered, last set taken?   */
+        cap.last_seq = sc;
+        cap.state = WTS_CAP_STATE_DONE;
+    } else {
+        cap.post_left--;
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_iir
+ *  FUNCTIONAL DESCRIPTION: Put a channel's sum of ANIN_SUM_N readings
+ *                          through its IIR, and start the next sum.
+ *  FORMAL PARAMETERS:      sum : Channel's sum.
+ *                          iir : Channel's IIR state, 2^k sums.
+ *                          k   : Channel's IIR shift, a constant.
+ *  RETURN VALUE:           Filtered sum, at half scale (0 - 32760).
+ *  SIDE EFFECTS:           None 
+ *  Notes:                  Called by ADC interrupt.  Always inlined, so
+ *                          with k a constant the shifts are fixed.
+ ******************************************************************************
+ */
+#pragma inline=forced
+static uint16_t anin_iir_step(uint16_t *sum, uint32_t *iir, uint8_t k)
+{
+    uint32_t y = *iir;
+
+    y += *sum - (y >> k);
+    *sum = 0;
+    *iir = y;
+    return (uint16_t)(y >> (k + 1));
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cal_apply
+ *  FUNCTIONAL DESCRIPTION: Calibrate a filtered sum.
+ *  FORMAL PARAMETERS:      h   : Filtered sum, at half scale (anin_iir_step).
+ *                          cal : Channel's calibration.
+ *  RETURN VALUE:           Filtered reading, 0 - 4095.
+ *  SIDE EFFECTS:           None 
+ *  Notes:                  Called by ADC interrupt.  The calibration is
+ *                          done at half sum scale, keeping 3 of the 4 bits
+ *                          below a reading the IIR gives.  With offsets
+ *                          limited to WTS_CAL_OFFSET_MAX the difference
+ *                          is at most 49136, so fits 16 bits, and the gain
+ *                          is one 16x16 hardware multiply.
+ ******************************************************************************
+ */
+static uint16_t anin_cal_apply(uint16_t h,
+                               const struct comms_anin_cal_chan *cal)
+{
+    int32_t x;
+
+    x = (int32_t)h - ((int32_t)cal->offset << (ANIN_SUM_SHIFT - 1));
+    if(x <= 0){
+        return 0;
+    }
+    x = (uint32_t)(uint16_t)x * cal->gain >> (15 + ANIN_SUM_SHIFT - 1);
+    return (x > 4095)? 4095: (uint16_t)x;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_tirq
+ *  FUNCTIONAL DESCRIPTION: Sum the analogue readings, and filter one
+ *                          channel's sum once it has ANIN_SUM_N readings.
+ *                          The probes are demodulated, their readings
+ *                          with the excitation on added and those with it
+ *                          off taken away, which cancels the ADC offset
+ *                          and anything much slower than the 400Hz
+ *                          excitation, (drift, mains pickup).
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           
- *  Notes:                  Called by timer interrupt.
+ *  Notes:                  Called by ADC interrupt, at the end of each
+ *                          conversion sequence.  The probes are switched
+ *                          after the readings are taken, on at phase 0 and
+ *                          off at phase 2, so phases 1 and 2 are read
+ *                          excited and 3 and 0 not.
  ******************************************************************************
  */
 void anin_tirq(void)
@@ -160,68 +780,79 @@ void anin_tirq(void)
     /*-- Take conductivity readings and perform conductivity signal     */
     /*   modulation.    */
     uint16_t sc;    /* Copy of sequence counter. */
+    uint16_t p1, p2;
+    uint16_t h;     /* Filtered sum, half scale. */
+    uint8_t slot;
     sc = sequence_counter;
+    p1 = ADC_CHNL(ADC_PROBE1) + ADC_CHNL(ADC_PROBE1_B);
+    p2 = ADC_CHNL(ADC_PROBE2) + ADC_CHNL(ADC_PROBE2_B);
     switch(sc & 3){
         case 0:
             P4OUT |= P4O6_PROBE_SAMPLE;
+            /*-- (Fall through, read before excitation on.) */
+        case 3:
+            probe_dm[0] -= p1;
+            probe_dm[1] -= p2;
             break;
         case 2:
-            anin_acum[ADC_PROBE1] += ADC_CHNL(ADC_PROBE1);
-            anin_acum[ADC_PROBE2] += ADC_CHNL(ADC_PROBE2);
             /*-- Drain conductivity probe caps.        */
             P4OUT &= ~P4O6_PROBE_SAMPLE;
+            /*-- (Fall through, read before drained.)  */
+        case 1:
+            probe_dm[0] += p1;
+            probe_dm[1] += p2;
             break;
     }
-    /*-- Accumulate averages of the non-synchronous ADC results */
-    anin_acum[ADC_PROBE1_TEMP]  += ADC_CHNL(ADC_PROBE1_TEMP);
-    anin_acum[ADC_PROBE2_TEMP]  += ADC_CHNL(ADC_PROBE2_TEMP);
-    anin_acum[ADC_SPARE1]       += ADC_CHNL(ADC_SPARE1);
-    anin_acum[ADC_WATER]        += ADC_CHNL(ADC_WATER);
-    anin_acum[ADC_CPU_TEMP]     += ADC_CHNL(ADC_CPU_TEMP);
-    anin_acum[ADC_VCC]          += ADC_CHNL(ADC_VCC);
-    amux_acum[sc % 8] += ADC_CHNL(ADC_MUX);
+    /*-- Sum the non-synchronous ADC results */
+    anin_sum[ADC_PROBE1_TEMP]   += ADC_CHNL(ADC_PROBE1_TEMP);
+    anin_sum[ADC_PROBE2_TEMP]   += ADC_CHNL(ADC_PROBE2_TEMP);
+    anin_sum[ADC_SPARE1]        += ADC_CHNL(ADC_SPARE1);
+    anin_sum[ADC_WATER]         += ADC_CHNL(ADC_WATER);
+    anin_sum[ADC_CPU_TEMP]      += ADC_CHNL(ADC_CPU_TEMP);
+    anin_sum[ADC_VCC]           += ADC_CHNL(ADC_VCC);
+    amux_sum[sc % 8] += ADC_CHNL(ADC_MUX);
+
+    if(cap.state >= WTS_CAP_STATE_ARMED &&  /* Capture running?             */
+       cap.state != WTS_CAP_STATE_DONE){
+        anin_cap_tirq(sc);
+    }
 
     sequence_counter = ++sc;    
-    ADC12CTL0 |= ADC12SC;       /* Trigger next conversion. */
-
-    if(sc % 256 == 0){
-        anin_av[ADC_PROBE1_TEMP] = anin_acum[ADC_PROBE1_TEMP] / 256;
-        anin_acum[ADC_PROBE1_TEMP] = 0;
-        anin_av[ADC_PROBE2_TEMP] = anin_acum[ADC_PROBE2_TEMP] / 256;
-        anin_acum[ADC_PROBE2_TEMP] = 0;
-        anin_av[ADC_SPARE1]      = anin_acum[ADC_SPARE1] / 256;
-        anin_acum[ADC_SPARE1] = 0;
-        anin_av[ADC_WATER]       = anin_acum[ADC_WATER] / 256;
-        anin_acum[ADC_WATER] = 0;
-        anin_av[ADC_CPU_TEMP]    = anin_acum[ADC_CPU_TEMP] / 256;
-        anin_acum[ADC_CPU_TEMP] = 0;
-        anin_av[ADC_VCC]    = anin_acum[ADC_VCC] / 256;
-        anin_acum[ADC_VCC] = 0;
-        if(sc % 1024 == 0){
-            anin_av[ADC_PROBE1] = anin_acum[ADC_PROBE1] / 256;
-            anin_acum[ADC_PROBE1] = 0;
-            anin_av[ADC_PROBE2] = anin_acum[ADC_PROBE2] / 256;
-            anin_acum[ADC_PROBE2] = 0;
-            if(sc % 2048 == 0){          
-                /* -- Unrolled loop. */
-                amux_av[0] = amux_acum[0] / 256;
-                amux_acum[0] = 0;
-                amux_av[1] = amux_acum[1] / 256;
-                amux_acum[1] = 0;
-                amux_av[2] = amux_acum[2] / 256;
-                amux_acum[2] = 0;
-                amux_av[3] = amux_acum[3] / 256;
-                amux_acum[3] = 0;
-                amux_av[4] = amux_acum[4] / 256;
-                amux_acum[4] = 0;
-                amux_av[5] = amux_acum[5] / 256;
-                amux_acum[5] = 0;
-                amux_av[6] = amux_acum[6] / 256;
-                amux_acum[6] = 0;
-                amux_av[7] = amux_acum[7] / 256;
-                amux_acum[7] = 0;
-            }
+
+    /*-- Slots 0 - 7 of each 16 ticks filter the ADC channels.  Slots    */
+    /*   8 - 15 filter the multiplexed inputs, (read one tick in 8),      */
+    /*   every 8th time.  16 ticks are 4 whole excitation cycles, so a    */
+    /*   probe's sum is 16 readings excited less 16 not, whatever the     */
+    /*   phase it starts at.  (Less than 0 is only noise.)                */
+    slot = sc % ANIN_SUM_N;
+    if(slot < ADC_CHANNELS){
+        if(slot == ADC_PROBE1 || slot == ADC_PROBE2){
+            int32_t *dm = &probe_dm[slot == ADC_PROBE2];
+            anin_sum[slot] = (*dm > 0)? (uint16_t)*dm: 0;
+            *dm = 0;
+            h = anin_iir_step(&anin_sum[slot], &anin_iir[slot],
+                              ANIN_K_PROBE);
+        } else if(slot == ADC_CPU_TEMP){
+            h = anin_iir_step(&anin_sum[slot], &anin_iir[slot],
+                              ANIN_K_CPU_TEMP);
+        } else {
+            h = anin_iir_step(&anin_sum[slot], &anin_iir[slot],
+                              ANIN_K_ADC);
+        }
+        anin_av[slot] = anin_cal_apply(h, &anin_cal.chan[slot]);
+        anin_av_gen++;              /* Readings updated.                */
+    } else if((sc / ANIN_SUM_N) % 8 == 0){
+        slot -= ADC_CHANNELS;
+        if(AMUX_CURRENTS & (1 << slot)){
+            h = anin_iir_step(&amux_sum[slot], &amux_iir[slot],
+                              AMUX_K_CURRENT);
+        } else {
+            h = anin_iir_step(&amux_sum[slot], &amux_iir[slot],
+                              AMUX_K_SUPPLY);
         }
+        amux_av[slot] = anin_cal_apply(h,
+                                       &anin_cal.chan[ADC_CHANNELS + slot]);
+        anin_av_gen++;              /* Readings updated.                */
     }
 }
 
@@ -229,21 +860,30 @@ void anin_tirq(void)
 /*
  ******************************************************************************
  *  FUNCTION NAME:          anin_irq
- *  FUNCTIONAL DESCRIPTION: End of ADC interrupt, update address of multiplexed
-                            input, and accumulated average totals.
+ *  FUNCTIONAL DESCRIPTION: End of ADC interrupt, set up the next conversion
+ *                          sequence, update address of multiplexed input,
+ *                          and accumulated average totals.
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           None 
  *  Note:                   The only ADC12 interrupt that we enable is the
- *                          one for when the MUX conversion is complete.
- *                          This allows us to update the multiplexer as soon
- *                          as possible to allow more settling time.
+ *                          one for when the last conversion is complete.
+ *                          The multiplexer is updated first to allow more
+ *                          settling time.
+ *                          The interrupt is cleared by anin_tirq reading
+ *                          the last result.
  ******************************************************************************
  */
 #pragma vector=ADC_VECTOR
 #pragma location="this_code_first"    /* Place near start of flash. */
 static __interrupt void ADC_interupt_handler(void)
 {
-    ADC_CHNL(ADC_MUX);  /* Dummy read to clear interrupt.   */
+    /*-- Latency here is from the compare, so includes the conversions. */
+    TIMER_LAT(TIMER_LAT_CCR1, TACCR1);
+    TACCR1 += CONDUCTIVITY_METER_IRQ_PERIOD;
+    ANIN_TRIG_ARM();
+    ADC12CTL0 &= ~ENC;
+    ADC12CTL0 |= ENC;
     P3OUT = (P3OUT & ~ 7) | ((sequence_counter + 1) & 7);
+    anin_tirq();                /* Synchronous ADC sampling.        */
 }
@@ -29,7 +29,9 @@
 #define ADC_WATER           5
 #define ADC_CPU_TEMP        6     /* Internal CPU temperature sensor. */
 #define ADC_VCC             7     /* VCC (3V3) supply.                */
-#define ADC_MUX             8     /* At end to increase settle time.  */
+#define ADC_MUX             8     /* Late on to increase settle time. */
+#define ADC_PROBE1_B        9     /* Second reading of each probe,    */
+#define ADC_PROBE2_B        10    /* (end of sequence).               */
 
 /*-- Mapping of ADC inputs (via MPC multiplexer sequencer) */
 #define INCH_PROBE1         (INCH_5)
@@ -66,4 +68,24 @@ void anin_init(void);
 void anin_state_machine(void);
 void anin_tirq(void);
 void anin_rd_to_comms(struct comms_wts_status *cm_st);
+uint8_t anin_rd_to_eu(struct comms_wts_status_eu *eu);
+uint8_t anin_cal_write(const struct comms_anin_cal *cal);
+uint8_t anin_cal_get(const struct comms_anin_cal **cal);
+
+/*-- Raw waveform capture. */
+#define ANIN_CAP_SAMPLES    (64)    /* Capture buffer size, uint16_t's. */
+
+struct anin_cap_info{
+    uint8_t  state;         /* WTS_CAP_STATE_xxx.                       */
+    uint16_t chan_mask;     /* Channels in each sample set.             */
+    uint16_t samples;       /* Number captured (when done).             */
+    uint16_t trig_offset;   /* First sample after the trigger.          */
+    uint16_t first_seq;     /* Sequence count of the first sample set.  */
+};
+
+uint8_t anin_cap_arm(const struct comms_anin_cap_cfg *cfg);
+void anin_cap_trigger(void);
+void anin_cap_stop(void);
+void anin_cap_info(struct anin_cap_info *info);
+uint8_t anin_cap_seg(uint16_t offset, const uint16_t **seg, uint8_t max);
 #endif /* #ifndef ADC_H */
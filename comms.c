@@ -38,22 +38,70 @@
 #include "timers.h"
 
 #include "rtc.h"
+
+/*--- Delta status: one entry per field of struct comms_wts_status.  */
+struct status_field{
+    uint8_t  offset;        /* Byte offset into struct comms_wts_status.  */
+    uint8_t  size;          /* Size in bytes.                             */
+    uint16_t deadband;      /* Change ignored, for 16 bit fields only.    */
+};
+
+#define STATUS_FIELD(f, db) \
+    { offsetof(struct comms_wts_status, f), \
+      sizeof(((struct comms_wts_status *)0)->f), (db) }
+
+/*    Analogue deadbands are in filtered ADC counts, enough to hide the  */
+/*    noise on slow moving inputs.  Others report any change.            */
+static const struct status_field status_fields[WTS_STATUS_FIELDS] = {
+    STATUS_FIELD(sw_version,                0),
+    STATUS_FIELD(UpTimeTick,                0),
+    STATUS_FIELD(UpTimeMinutes,             0),
+    STATUS_FIELD(BadCrcCount,               0),
+    STATUS_FIELD(cpu_temperature,           8),
+    STATUS_FIELD(bits,                      0),
+    STATUS_FIELD(port_raw_inputs,           0),
+    STATUS_FIELD(anin_filt_overflows,       0),
+    STATUS_FIELD(cool_air_pos_estimate,     0),
+    STATUS_FIELD(anin_probe1_conductivity,  2),
+    STATUS_FIELD(anin_probe1_temperature,   2),
+    STATUS_FIELD(anin_probe2_conductivity,  2),
+    STATUS_FIELD(anin_probe2_temperature,   2),
+    STATUS_FIELD(anin_spare1,               2),
+    STATUS_FIELD(anin_water_meter,          2),
+    STATUS_FIELD(anin_3V6,                  16),
+    STATUS_FIELD(resurved,                  0),
+    STATUS_FIELD(anin_24V,                  16),
+    STATUS_FIELD(anin_polish_current,       4),
+    STATUS_FIELD(anin_condensate_current,   4),
+    STATUS_FIELD(anin_5V,                   16),
+    STATUS_FIELD(anin_1V2,                  16),
+    STATUS_FIELD(anin_fill_current,         4),
+    STATUS_FIELD(anin_purge_current,        4),
+    STATUS_FIELD(anin_boost_current,        4),
+};
+
+/*    status_base holds the fields as last sent.  The CCP has them all  */
+/*    if it got our last response, else it has those as at              */
+/*    status_base_seq bar the fields flagged in status_unacked, which   */
+/*    are sent again until it does.                                     */
+static struct comms_wts_status status_base; /* Fields as last sent.      */
+static uint8_t status_unacked[WTS_STATUS_BITMAP_SIZE];  /* Sent since    */
+                                            /* status_base_seq.          */
+static uint8_t status_base_seq;             /* 0 if no base copy.        */
+static uint8_t status_sent_seq;
+
 /*
  ******************************************************************************
  *  FUNCTION NAME:          ctrl_status_wr
  *  FUNCTIONAL DESCRIPTION: Take supplied packet for required outputs, and
  *                          set up system variables to achieve those outputs.
- *  FORMAL PARAMETERS:      None
+ *  FORMAL PARAMETERS:      ctrl : Control structure from CCP.
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           None 
  ******************************************************************************
  */
-static void ctrl_status_wr(const uint8_t *payload)
+static void ctrl_status_wr(const struct comms_wts_ctrl *ctrl)
 {
-    struct comms_wts_ctrl *ctrl;
-
-    ctrl = (struct comms_wts_ctrl*) &payload[1];
-
     /*--- Adjust outputs according to control structure received from CCP */
     steam_flowrate_set(ctrl->flg.SteamEnable? ctrl->steam_flow: 0);
     cooling_air_valve_set(
@@ -83,6 +131,35 @@ static void ctrl_status_wr(const uint8_t *payload)
     pwm2_set(ctrl->pwm2);
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ctrl_status_update
+ *  FUNCTIONAL DESCRIPTION: Bring wts_status up to date before it is sent.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void ctrl_status_update(void)
+{
+    wts_status.sw_version = cfclSoftwareVersion;
+
+    rtc_getUpTime(&wts_status.UpTimeTick);
+    /*wts_status.BadCrcCount; Maintained in gsebus_ser.c */
+    wts_status.bits = pio_din_get();
+
+    wts_status.port_raw_inputs[0] = P1IN;
+    wts_status.port_raw_inputs[1] = P2IN;
+    wts_status.port_raw_inputs[2] = P3IN;
+    wts_status.port_raw_inputs[3] = P4IN;
+    wts_status.port_raw_inputs[4] = P5IN;
+    
+    wts_status.cool_air_pos_estimate = cooling_air_get_pos();
+
+    /*--- Copy in analogue readings. */
+    anin_rd_to_comms(&wts_status);
+}
+
 /*
  ******************************************************************************
  *  FUNCTION NAME:          form_status_response
@@ -107,40 +184,275 @@ static void ctrl_status_rd(void)
     gsebus_formtx_add_uint8(WTS_DADR_CTRL_STATUS);
 
     /*---- Update some of the stuff before sending. */
-    wts_status.sw_version = cfclSoftwareVersion;
+    ctrl_status_update();
 
-    rtc_getUpTime(&wts_status.UpTimeTick);
-    /*wts_status.BadCrcCount; Maintained in gsebus_ser.c */
-    wts_status.bits = pio_din_get();
+    /*-- wts_status is only written by the main line, and the interrupt  */
+    /*   driven readings in it are taken consistently by anin_rd_to_comms */
+    /*   so no need to turn interrupts off for the copy.                   */
+    gsebus_formtx_add_mem(&wts_status, sizeof(wts_status));
+}
 
-    wts_status.port_raw_inputs[0] = P1IN;
-    wts_status.port_raw_inputs[1] = P2IN;
-    wts_status.port_raw_inputs[2] = P3IN;
-    wts_status.port_raw_inputs[3] = P4IN;
-    wts_status.port_raw_inputs[4] = P5IN;
-    
-    wts_status.cool_air_pos_estimate = cooling_air_get_pos();
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          status_field_changed
+ *  FUNCTIONAL DESCRIPTION: Test if a status field has moved from the value
+ *                          last sent by more than its deadband.
+ *  FORMAL PARAMETERS:      f   : Field to test.
+ *  RETURN VALUE:           NZ if changed.
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static uint8_t status_field_changed(const struct status_field *f)
+{
+    const uint8_t *a = (const uint8_t *)&wts_status + f->offset;
+    const uint8_t *b = (const uint8_t *)&status_base + f->offset;
 
-    /*--- Copy in analogue readings. */
-    anin_rd_to_comms(&wts_status);
+    if(f->deadband != 0){               /* (Only ever on 16 bit fields.) */
+        uint16_t diff = *(const uint16_t *)a - *(const uint16_t *)b;
+        if(diff & 0x8000){
+            diff = -diff;               /* Either direction.            */
+        }
+        return diff > f->deadband;
+    }
+    return memcmp(a, b, f->size) != 0;
+}
 
-    __disable_interrupt();
-    gsebus_formtx_add_mem(&wts_status, sizeof(wts_status));
-    __enable_interrupt();
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          status_delta_rd
+ *  FUNCTIONAL DESCRIPTION: Form a delta encoded status response, just the
+ *                          fields changed since the response the CCP says
+ *                          it has.  See WTS_DADR_STATUS_DELTA.
+ *  FORMAL PARAMETERS:      ack_seq : Seq of last response CCP received,
+ *                                    0 for a full snapshot.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void status_delta_rd(uint8_t ack_seq)
+{
+    uint8_t bitmap[WTS_STATUS_BITMAP_SIZE];
+    const struct status_field *f;
+    uint8_t i, bit;
+
+    if(flash_err){
+        /*-- Trash normal response. */
+        gsebus_formtx_nack();
+        gsebus_formtx_add_cstr("Bad CRC");
+        return;
+    }
+
+    /*-- Work out which copy the CCP has to build on. */
+    if(ack_seq == 0){                       /* Full snapshot asked for.   */
+        status_base_seq = 0;
+    } else if(ack_seq == status_sent_seq){  /* Got our last response, so  */
+        status_base_seq = status_sent_seq;  /* has all of status_base.    */
+        memset(status_unacked, 0, sizeof(status_unacked));
+    } else if(ack_seq != status_base_seq){  /* Lost track, start again.   */
+        status_base_seq = 0;
+    }
+
+    /*-- wts_status is main line only (see ctrl_status_rd), so it is     */
+    /*   compared and sent as it is, with no copy.                        */
+    ctrl_status_update();
+
+    /*-- Send fields that changed or that the CCP may not have. */
+    memset(bitmap, 0, sizeof(bitmap));
+    for(i = 0, f = status_fields; i < WTS_STATUS_FIELDS; i++, f++){
+        bit = 1 << (i & 7);
+        if(status_base_seq == 0 || (status_unacked[i >> 3] & bit) ||
+           status_field_changed(f)){
+            bitmap[i >> 3] |= bit;
+            memcpy((uint8_t *)&status_base + f->offset,
+                   (uint8_t *)&wts_status + f->offset, f->size);
+        }
+    }
+    for(i = 0; i < WTS_STATUS_BITMAP_SIZE; i++){
+        status_unacked[i] |= bitmap[i];
+    }
+    if(++status_sent_seq == 0){             /* 0 is kept for "none".      */
+        status_sent_seq = 1;
+    }
+
+    gsebus_formtx_ack();
+    gsebus_formtx_add_uint8(WTS_DADR_STATUS_DELTA);
+    gsebus_formtx_add_uint8(status_sent_seq);
+    gsebus_formtx_add_uint8(status_base_seq);
+    gsebus_formtx_add_mem(bitmap, sizeof(bitmap));
+    for(i = 0, f = status_fields; i < WTS_STATUS_FIELDS; i++, f++){
+        if(bitmap[i >> 3] & (1 << (i & 7))){
+            gsebus_formtx_add_mem((uint8_t *)&wts_status + f->offset,
+                                  f->size);
+        }
+    }
+}
+
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cap_rd
+ *  FUNCTIONAL DESCRIPTION: Give capture state, and a chunk of the captured
+ *                          samples.  See WTS_DADR_ANIN_CAPTURE.
+ *  FORMAL PARAMETERS:      offset : First sample wanted.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void anin_cap_rd(uint16_t offset)
+{
+    struct anin_cap_info info;
+    const uint16_t *seg;
+    uint8_t left = WTS_CAP_CHUNK;
+    uint8_t n;
+
+    anin_cap_info(&info);
+    gsebus_formtx_ack();
+    gsebus_formtx_add_uint8(WTS_DADR_ANIN_CAPTURE);
+    gsebus_formtx_add_uint8(info.state);
+    gsebus_formtx_add_uint16(info.chan_mask);
+    gsebus_formtx_add_uint16(info.samples);
+    gsebus_formtx_add_uint16(info.trig_offset);
+    gsebus_formtx_add_uint16(info.first_seq);
+    gsebus_formtx_add_uint16(offset);
+    /*-- Straight out of the capture ring, no copy on the stack. */
+    while(left != 0 && (n = anin_cap_seg(offset, &seg, left)) != 0){
+        gsebus_formtx_add_mem((void *)seg, n * sizeof(*seg));
+        offset += n;
+        left   -= n;
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cap_wr
+ *  FUNCTIONAL DESCRIPTION: Carry out a capture action from the CCP.
+ *  FORMAL PARAMETERS:      payload : Location ID, action, set up.
+ *  RETURN VALUE:           Z if OK, else WTS_ERR_xxx code.
+ *  SIDE EFFECTS:           Set up moved back over the action in payload.
+ ******************************************************************************
+ */
+static uint8_t anin_cap_wr(uint8_t *payload)
+{
+    switch(payload[1]){
+        case WTS_CAP_STOP:
+            anin_cap_stop();
+            return 0;
+        case WTS_CAP_ARM:
+            /*-- Set up follows the action, at an odd address, so slide */
+            /*   it back over the (used) action to read it as words.    */
+            memmove(&payload[1], &payload[2],
+                    sizeof(struct comms_anin_cap_cfg));
+            return anin_cap_arm((struct comms_anin_cap_cfg *)&payload[1]);
+        case WTS_CAP_TRIGGER:
+            anin_cap_trigger();
+            return 0;
+    }
+    return WTS_ERR_CAP_CFG;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fw_seg_crc_rd
+ *  FUNCTIONAL DESCRIPTION: Form WTS_DADR_FW_SEG_CRC response, the CRC of
+ *                          each segment of the running then the new code.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void fw_seg_crc_rd(void)
+{
+    uint8_t staging, seg;
+
+    gsebus_formtx_ack();
+    gsebus_formtx_add_uint8(WTS_DADR_FW_SEG_CRC);
+    for(staging = 0; staging < 2; staging++){
+        for(seg = 0; seg < WTS_FW_SEGS; seg++){
+            gsebus_formtx_add_uint16(reflash_seg_crc(staging, seg));
+        }
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fw_seg_map_rd
+ *  FUNCTIONAL DESCRIPTION: Form WTS_DADR_FW_SEG_MAP response, which
+ *                          segments of the new code have been loaded.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void fw_seg_map_rd(void)
+{
+    uint16_t resume;
+    uint16_t map = fls_fwug_seg_map(&resume);
+
+    gsebus_formtx_ack();
+    gsebus_formtx_add_uint8(WTS_DADR_FW_SEG_MAP);
+    gsebus_formtx_add_uint16(map);
+    gsebus_formtx_add_uint16(resume);
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          status_eu_rd
+ *  FUNCTIONAL DESCRIPTION: Form WTS_DADR_STATUS_EU response, the readings
+ *                          in engineering units.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void status_eu_rd(void)
+{
+    struct comms_wts_status_eu eu;
+    uint8_t flags = anin_rd_to_eu(&eu);
+
+    gsebus_formtx_ack();
+    gsebus_formtx_add_uint8(WTS_DADR_STATUS_EU);
+    gsebus_formtx_add_uint8(flags);     /* WTS_EU_xxx.                  */
+    gsebus_formtx_add_mem(&eu, sizeof(eu));
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          anin_cal_rd
+ *  FUNCTIONAL DESCRIPTION: Form WTS_DADR_ANIN_CAL response, the calibration
+ *                          in use.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static void anin_cal_rd(void)
+{
+    const struct comms_anin_cal *cal;
+    uint8_t state = anin_cal_get(&cal);
+
+    gsebus_formtx_ack();
+    gsebus_formtx_add_uint8(WTS_DADR_ANIN_CAL);
+    gsebus_formtx_add_uint8(state);
+    gsebus_formtx_add_mem((void *)cal, sizeof(*cal));
+}
 
 /*
  ******************************************************************************
  *  FUNCTION NAME:          cmd_wr_data
  *  FUNCTIONAL DESCRIPTION: "Write data" as specified for a given location.
- *  FORMAL PARAMETERS:      None
+ *  FORMAL PARAMETERS:      payload : Location ID, then any data.
+ *                          len     : Bytes in payload.
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           None 
  ******************************************************************************
  */
-static uint8_t cmd_rd_data(uint8_t *payload)
+static uint8_t cmd_rd_data(uint8_t *payload, uint8_t len)
 {
+    /*-- Only these locations take anything after the location ID. */
+    if(len != ((*payload == WTS_DADR_STATUS_DELTA)? 2:
+               (*payload == WTS_DADR_ANIN_CAPTURE)? 3: 1)){
+        return 1;                       /* Wrong length for location.   */
+    }
     /*-- Rd data command starts with an "address" */
     switch(*payload){
         case WTS_DADR_FW_ID:
@@ -161,6 +473,44 @@ static uint8_t cmd_rd_data(uint8_t *payload)
         case WTS_DADR_CTRL_STATUS:
             ctrl_status_rd();           /* Give system status.          */
             return 0;
+        case WTS_DADR_BAUD_RATE:
+            gsebus_formtx_ack();
+            gsebus_formtx_add_uint8(WTS_DADR_BAUD_RATE);
+            gsebus_formtx_add_uint8(ser_baud_get());
+            return 0;
+        case WTS_DADR_STATUS_DELTA:
+            status_delta_rd(payload[1]);    /* Changes since CCP's copy.    */
+            return 0;
+        case WTS_DADR_ANIN_CAPTURE:
+            anin_cap_rd(payload[1] | (payload[2] << 8));
+            return 0;
+#ifdef TIMER_LAT_ENABLE
+        case WTS_DADR_ISR_LATENCY:
+            gsebus_formtx_ack();
+            gsebus_formtx_add_uint8(WTS_DADR_ISR_LATENCY);
+            gsebus_formtx_add_uint16(timer_latency_max[TIMER_LAT_CCR0]);
+            gsebus_formtx_add_uint16(timer_latency_max[TIMER_LAT_CCR1]);
+            gsebus_formtx_add_uint16(timer_latency_max[TIMER_LAT_CCR2]);
+            return 0;
+#endif
+        case WTS_DADR_FW_SEG_CRC:
+            fw_seg_crc_rd();
+            return 0;
+        case WTS_DADR_FW_SEG_MAP:
+            fw_seg_map_rd();
+            return 0;
+        case WTS_DADR_REFLASH:
+            gsebus_formtx_ack();
+            gsebus_formtx_add_uint8(WTS_DADR_REFLASH);
+            gsebus_formtx_add_uint8(reflash_last_segs());
+            gsebus_formtx_add_uint8(reflash_boot_status());
+            return 0;
+        case WTS_DADR_STATUS_EU:
+            status_eu_rd();
+            return 0;
+        case WTS_DADR_ANIN_CAL:
+            anin_cal_rd();
+            return 0;
         default:
             break;
     }
@@ -173,34 +523,106 @@ static uint8_t cmd_rd_data(uint8_t *payload)
  *  FUNCTIONAL DESCRIPTION: Process supplied data for a given location_id
  *                          If "writing" is supported for a given location ID
  *                          the data is written to the specified "location".
- *  FORMAL PARAMETERS:      None
+ *  FORMAL PARAMETERS:      payload : Location ID, then the data.
+ *                          len     : Bytes in payload.
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           None 
  *  Note:                   The idea of a location is a concept only, we just
  *                          treat different locations as different commands.
+ *                          The data must be exactly the size the location
+ *                          takes, so a short item in a WTS_CMD_MULTI batch
+ *                          cannot run on into the next one.
  ******************************************************************************
  */
-static uint8_t cmd_wr_data(uint8_t *payload)
+static uint8_t cmd_wr_data(uint8_t *payload, uint8_t len)
 {
+    const struct comms_fw_upgrade *fw;
+    const struct comms_fw_upgrade_z *fwz;
     uint8_t status;
     switch(payload[0]){             /* Payload starts with the location ID. */
         case WTS_DADR_CTRL_STATUS:  /* Control / status packet.             */
-            ctrl_status_wr(payload);/* Do something with payload data.      */
+            if(len != 1 + sizeof(struct comms_wts_ctrl)) break;
+            ctrl_status_wr((struct comms_wts_ctrl *)&payload[1]);
             gsebus_formtx_ack();    /* Acknolwage that we've accepted the data*/
             gsebus_formtx_add_uint8(WTS_DADR_TGT_DEV); /* What was accepted */
             return 0;   /* No error. */
         case WTS_DADR_FW_BLOCK:
-            status = fls_fwug_cmd((struct comms_fw_upgrade *)(&payload[1]));
+            /*-- Written from the Rx packet in the background, comms_poll */
+            /*   holds on to the packet until done.                       */
+            fw = (struct comms_fw_upgrade *)(&payload[1]);
+            if(len < 1 + offsetof(struct comms_fw_upgrade, data) ||
+               len != 1 + offsetof(struct comms_fw_upgrade, data) + fw->len){
+                break;
+            }
+            status = fls_fwug_cmd(fw);
             gsebus_formtx_ack();
             gsebus_formtx_add_uint8(WTS_DADR_FW_BLOCK); /* What was accepted */
             gsebus_formtx_add_uint8(status);            /* How we went. */
+            if(status == WTS_ERR_FWUG_WRFAIL){          /* Where to resend. */
+                gsebus_formtx_add_uint16(fls_fwug_error_addr());
+            }
+            return 0;
+        case WTS_DADR_FW_BLOCK_Z:
+            fwz = (struct comms_fw_upgrade_z *)(&payload[1]);
+            if(len < 1 + offsetof(struct comms_fw_upgrade_z, data) ||
+               len != 1 + offsetof(struct comms_fw_upgrade_z, data) +
+                      fwz->zlen){
+                break;
+            }
+            status = fls_fwug_z_cmd(fwz);
+            gsebus_formtx_ack();
+            gsebus_formtx_add_uint8(WTS_DADR_FW_BLOCK_Z);
+            gsebus_formtx_add_uint8(status);
+            if(status == WTS_ERR_FWUG_WRFAIL){
+                gsebus_formtx_add_uint16(fls_fwug_error_addr());
+            }
             return 0;
         case WTS_DADR_REFLASH:
-            status = do_reflash();  /* Will hopefully upgrade the firmware */
+            if(len != 1) break;
+            if(fls_fwug_busy()){    /* (Block earlier in the same batch.) */
+                status = WTS_ERR_FWUG_BUSY;
+            } else {
+                /*-- Will hopefully upgrade the firmware. */
+                status = do_reflash(REFLASH_CHANGED);
+            }
             gsebus_formtx_ack();
             gsebus_formtx_add_uint8(WTS_DADR_REFLASH); /* What was accepted */
             gsebus_formtx_add_uint8(status);
             return 0;
+        case WTS_DADR_BAUD_RATE:
+            /*-- Reply goes at the old rate, then we switch over.          */
+            if(len != 2) break;
+            status = ser_baud_request(payload[1]);
+            gsebus_formtx_ack();
+            gsebus_formtx_add_uint8(WTS_DADR_BAUD_RATE); /* What was accepted */
+            gsebus_formtx_add_uint8(status);
+            return 0;
+        case WTS_DADR_ANIN_CAPTURE:
+            if(len < 2 || len != ((payload[1] == WTS_CAP_ARM)?
+                                  2 + sizeof(struct comms_anin_cap_cfg): 2)){
+                break;
+            }
+            status = anin_cap_wr(payload);
+            gsebus_formtx_ack();
+            gsebus_formtx_add_uint8(WTS_DADR_ANIN_CAPTURE);
+            gsebus_formtx_add_uint8(status);
+            return 0;
+        case WTS_DADR_ANIN_CAL:
+            /*-- Stalls ~11ms erasing INFOA, the CCP is waiting on this. */
+            if(len != 1 + sizeof(struct comms_anin_cal)) break;
+            status = anin_cal_write((struct comms_anin_cal *)&payload[1]);
+            gsebus_formtx_ack();
+            gsebus_formtx_add_uint8(WTS_DADR_ANIN_CAL);
+            gsebus_formtx_add_uint8(status);
+            return 0;
+#ifdef TIMER_LAT_ENABLE
+        case WTS_DADR_ISR_LATENCY:
+            if(len != 1) break;
+            timer_latency_clear();      /* Start a new measurement.     */
+            gsebus_formtx_ack();
+            gsebus_formtx_add_uint8(WTS_DADR_ISR_LATENCY);
+            return 0;
+#endif
     }
     return 1;           /* Is error unsupported address. */
 }
@@ -211,9 +633,10 @@ static uint8_t cmd_wr_data(uint8_t *payload)
  *  FUNCTIONAL DESCRIPTION: Process supplied data for a given location_id
  *                          as per a cmd_wr_data command, and respond with 
  *                          data for the same location_id, as per a cmd_rd_data.
- *  FORMAL PARAMETERS:      None
+ *  FORMAL PARAMETERS:      payload : Location ID, then the data.
+ *                          len     : Bytes in payload.
  *  RETURN VALUE:           None
- *  SIDE EFFECTS:           None 
+ *  SIDE EFFECTS:           STATUS_DELTA control moved back within payload.
  *  Note:                   There need be no correlation between the data
  *                          written and the data read.  For example the command
  *                          can give the required system output states, and
@@ -221,17 +644,113 @@ static uint8_t cmd_wr_data(uint8_t *payload)
  *                          inputs.
  ******************************************************************************
  */
-static uint8_t cmd_rw_data(uint8_t *payload)
+static uint8_t cmd_rw_data(uint8_t *payload, uint8_t len)
 {
+    uint8_t seq;
+
     switch(payload[0]){             /* Payload starts with the location ID. */
         case WTS_DADR_CTRL_STATUS: /* Control / status packet.             */
-            ctrl_status_wr(payload);/* Same as for cmd_wr_data command      */
+            /*-- Same as for cmd_wr_data command.  */
+            if(len != 1 + sizeof(struct comms_wts_ctrl)) break;
+            ctrl_status_wr((struct comms_wts_ctrl *)&payload[1]);
             ctrl_status_rd();       /* Respond as per cmd_rd_data command   */
             return 0;
+        case WTS_DADR_STATUS_DELTA: /* Control / delta status packet.       */
+            /*-- Control follows the seq of last response received.  */
+            /*   That puts it at an odd address, so slide it back over the */
+            /*   seq to read it as words.                                   */
+            if(len != 2 + sizeof(struct comms_wts_ctrl)) break;
+            seq = payload[1];
+            memmove(&payload[1], &payload[2], sizeof(struct comms_wts_ctrl));
+            ctrl_status_wr((struct comms_wts_ctrl *)&payload[1]);
+            status_delta_rd(seq);
+            return 0;
     }
     return 1;   /* Unsupported address. */
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          cmd_dispatch
+ *  FUNCTIONAL DESCRIPTION: Carry out one read, write, or read write command.
+ *  FORMAL PARAMETERS:      cmd     : Command code.
+ *                          payload : Location ID, then any data.
+ *                          len     : Bytes in payload.
+ *  RETURN VALUE:           NZ if command or location unsupported, or len
+ *                          is wrong for the location.
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+static uint8_t cmd_dispatch(uint8_t cmd, uint8_t *payload, uint8_t len)
+{
+    if(len == 0){
+        return 1;                       /* No location ID.              */
+    }
+    switch(cmd){
+        case WTS_CMD_RD_DATA:
+            return cmd_rd_data(payload, len);
+        case WTS_CMD_WR_DATA:
+            return cmd_wr_data(payload, len);
+        case WTS_CMD_WR_RD_DATA:
+            return cmd_rw_data(payload, len);
+    }
+    return 1;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          cmd_multi
+ *  FUNCTIONAL DESCRIPTION: Carry out a batch of commands, each to its own
+ *                          location, giving one combined response.
+ *                          See WTS_CMD_MULTI for the layout.
+ *  FORMAL PARAMETERS:      payload : List of items.
+ *                          size    : Size of payload in bytes.
+ *  RETURN VALUE:           NZ if the item list is badly formed.
+ *  SIDE EFFECTS:           Items may be moved back a byte within payload.
+ ******************************************************************************
+ */
+static uint8_t cmd_multi(uint8_t *payload, uint8_t size)
+{
+    uint16_t pos;
+    uint8_t *item;
+    uint8_t n;
+
+    /*-- Check the whole list before acting on any of it. */
+    for(pos = 0; pos < size; pos += 2 + n){
+        if(size - pos < 2){
+            return 1;                   /* Item header cut short.       */
+        }
+        n = payload[pos + 1];
+        if(n == 0 || n > size - pos - 2){
+            return 1;                   /* No location, or cut short.   */
+        }
+    }
+
+    gsebus_formtx_ack();
+    for(pos = 0; pos < size; pos += 2 + n){
+        n = payload[pos + 1];
+        if(gsebus_formtx_item_start()){
+            break;                      /* Response full.               */
+        }
+        /*-- Handlers read the data after the location ID as words, so */
+        /*   that must be at an even frame index (STX, header, then     */
+        /*   payload), as for a single command.  If not, slide the item */
+        /*   back over its (used) length byte.                          */
+        item = &payload[pos + 2];
+        if((1 + sizeof(gsebus_header_t) + pos + 3) & 1){
+            memmove(item - 1, item, n);
+            item--;
+        }
+        if(cmd_dispatch(payload[pos], item, n)){
+            gsebus_formtx_nack();       /* Just this item failed.       */
+        }
+        if(gsebus_formtx_item_end()){
+            break;                      /* Item did not fit.            */
+        }
+    }
+    return 0;
+}
+
 /*
  ******************************************************************************
  *  FUNCTION NAME:          cmd_poll
@@ -247,22 +766,22 @@ void comms_poll(void)
     gsebus_header_t *hdr;
     uint8_t *payload;
     uint8_t is_error = 0;
+
+    /*-- A firmware block is written straight out of its Rx packet, so   */
+    /*   hold on to that (and leave any later packets queued) until done. */
+    if(fls_fwug_busy()){
+        ser_state_machine();
+        return;
+    }
     hdr = gsebus_rx_pkt();      /* Poll for new message on serial interface */
     if(hdr == NULL) return;                     /* No new message.          */
     payload = ((uint8_t *)hdr) + sizeof(*hdr);  /* Payload follows header.  */
-    switch(hdr->cmd){                           /* Message to process.      */
-        case WTS_CMD_RD_DATA:
-            is_error = cmd_rd_data(payload);
-            break;
-        case WTS_CMD_WR_DATA:
-            is_error = cmd_wr_data(payload);
-            break;
-        case WTS_CMD_WR_RD_DATA:
-            is_error = cmd_rw_data(payload);
-            break;
-        default:
-            is_error = 1;
-            break;
+    if(hdr->cmd == WTS_CMD_MULTI){              /* Message to process.      */
+        /*-- len is the index of the last CRC byte, (STX at index 0). */
+        is_error = cmd_multi(payload, hdr->len - sizeof(*hdr) - 2);
+    } else {
+        is_error = cmd_dispatch(hdr->cmd, payload,
+                                hdr->len - sizeof(*hdr) - 2);
     }
     if(is_error){
         gsebus_formtx_nack();                   /* Report for failure.     */
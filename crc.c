@@ -23,9 +23,17 @@
 
 /*#define unitTestFunction 1*/
 
+#if CRC_KERNEL == CRC_KERNEL_NIBBLE
+/* CRC-16 table lookup, a nibble at a time.  */
+#pragma location="this_data_first"    /* Place near start of flash. */
+const uint16_t crc16_rev_nibble[16] =
+{   0x0000, 0xCC01, 0xD801, 0x1400, 0xF001, 0x3C00, 0x2800, 0xE401,
+    0xA001, 0x6C00, 0x7800, 0xB401, 0x5000, 0x9C01, 0x8801, 0x4400
+};
+#else
 /* CRC-16 table lookup */
 #pragma location="this_data_first"    /* Place near start of flash. */
-static const uint16_t crc16_rev_table[256] =
+const uint16_t crc16_rev_table[256] =
 {   0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
     0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
     0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
@@ -59,21 +67,105 @@ static const uint16_t crc16_rev_table[256] =
     0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
     0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040
 };
+#endif
+
+#if CRC_KERNEL == CRC_KERNEL_SLICE2
+/* Second byte of a word on, ie. crc16_rev_table[] stepped over a zero byte. */
+#pragma location="this_data_first"    /* Place near start of flash. */
+static const uint16_t crc16_rev_table2[256] =
+{   0x0000, 0x9001, 0x6001, 0xF000, 0xC002, 0x5003, 0xA003, 0x3002,
+    0xC007, 0x5006, 0xA006, 0x3007, 0x0005, 0x9004, 0x6004, 0xF005,
+    0xC00D, 0x500C, 0xA00C, 0x300D, 0x000F, 0x900E, 0x600E, 0xF00F,
+    0x000A, 0x900B, 0x600B, 0xF00A, 0xC008, 0x5009, 0xA009, 0x3008,
+    0xC019, 0x5018, 0xA018, 0x3019, 0x001B, 0x901A, 0x601A, 0xF01B,
+    0x001E, 0x901F, 0x601F, 0xF01E, 0xC01C, 0x501D, 0xA01D, 0x301C,
+    0x0014, 0x9015, 0x6015, 0xF014, 0xC016, 0x5017, 0xA017, 0x3016,
+    0xC013, 0x5012, 0xA012, 0x3013, 0x0011, 0x9010, 0x6010, 0xF011,
+    0xC031, 0x5030, 0xA030, 0x3031, 0x0033, 0x9032, 0x6032, 0xF033,
+    0x0036, 0x9037, 0x6037, 0xF036, 0xC034, 0x5035, 0xA035, 0x3034,
+    0x003C, 0x903D, 0x603D, 0xF03C, 0xC03E, 0x503F, 0xA03F, 0x303E,
+    0xC03B, 0x503A, 0xA03A, 0x303B, 0x0039, 0x9038, 0x6038, 0xF039,
+    0x0028, 0x9029, 0x6029, 0xF028, 0xC02A, 0x502B, 0xA02B, 0x302A,
+    0xC02F, 0x502E, 0xA02E, 0x302F, 0x002D, 0x902C, 0x602C, 0xF02D,
+    0xC025, 0x5024, 0xA024, 0x3025, 0x0027, 0x9026, 0x6026, 0xF027,
+    0x0022, 0x9023, 0x6023, 0xF022, 0xC020, 0x5021, 0xA021, 0x3020,
+    0xC061, 0x5060, 0xA060, 0x3061, 0x0063, 0x9062, 0x6062, 0xF063,
+    0x0066, 0x9067, 0x6067, 0xF066, 0xC064, 0x5065, 0xA065, 0x3064,
+    0x006C, 0x906D, 0x606D, 0xF06C, 0xC06E, 0x506F, 0xA06F, 0x306E,
+    0xC06B, 0x506A, 0xA06A, 0x306B, 0x0069, 0x9068, 0x6068, 0xF069,
+    0x0078, 0x9079, 0x6079, 0xF078, 0xC07A, 0x507B, 0xA07B, 0x307A,
+    0xC07F, 0x507E, 0xA07E, 0x307F, 0x007D, 0x907C, 0x607C, 0xF07D,
+    0xC075, 0x5074, 0xA074, 0x3075, 0x0077, 0x9076, 0x6076, 0xF077,
+    0x0072, 0x9073, 0x6073, 0xF072, 0xC070, 0x5071, 0xA071, 0x3070,
+    0x0050, 0x9051, 0x6051, 0xF050, 0xC052, 0x5053, 0xA053, 0x3052,
+    0xC057, 0x5056, 0xA056, 0x3057, 0x0055, 0x9054, 0x6054, 0xF055,
+    0xC05D, 0x505C, 0xA05C, 0x305D, 0x005F, 0x905E, 0x605E, 0xF05F,
+    0x005A, 0x905B, 0x605B, 0xF05A, 0xC058, 0x5059, 0xA059, 0x3058,
+    0xC049, 0x5048, 0xA048, 0x3049, 0x004B, 0x904A, 0x604A, 0xF04B,
+    0x004E, 0x904F, 0x604F, 0xF04E, 0xC04C, 0x504D, 0xA04D, 0x304C,
+    0x0044, 0x9045, 0x6045, 0xF044, 0xC046, 0x5047, 0xA047, 0x3046,
+    0xC043, 0x5042, 0xA042, 0x3043, 0x0041, 0x9040, 0x6040, 0xF041
+};
+#endif
+
+#if CRC_KERNEL == CRC_KERNEL_NIBBLE
+/******************************************************************************/
+/* Single byte step, low nibble first.  (A function as ch is used twice.)    */
+#pragma location="this_code_first"    /* Place near start of flash. */
+uint16_t crc_rev_step_nibble(uint16_t crc, uint8_t ch)
+{
+    crc = (crc >> 4) ^ crc16_rev_nibble[(crc ^ ch) & 0x0F];
+    return (crc >> 4) ^ crc16_rev_nibble[(crc ^ (ch >> 4)) & 0x0F];
+}
+#endif
 
 /******************************************************************************/
 #pragma location="this_code_first"    /* Place near start of flash. */
 static uint16_t CalcCrcRev(const void *p, short bufferSize)
 {
     const uint8_t  *bufferPtr = p;
-    uint16_t theCrc = ~0;
+    uint16_t theCrc = crc_rev_init;
+#if CRC_KERNEL == CRC_KERNEL_SLICE2
+    /*-- A word at a time, (little endian, as the bytes go). */
+    if((size_t)bufferPtr & 1){
+        theCrc = crc_rev_step(theCrc, *bufferPtr++);
+        bufferSize--;
+    }
+    for( ; bufferSize >= 2; bufferSize -= 2){
+        theCrc ^= *(const uint16_t *)bufferPtr;
+        theCrc = crc16_rev_table2[theCrc & 0x00FF] ^
+                 crc16_rev_table[theCrc >> 8];
+        bufferPtr += 2;
+    }
+    if(bufferSize != 0){
+        theCrc = crc_rev_step(theCrc, *bufferPtr);
+    }
+#else
     do {
-        uint16_t temp = theCrc ^ *bufferPtr++;
-        theCrc = (theCrc >> 8) ^ crc16_rev_table[ temp & 0x00FF];
+        theCrc = crc_rev_step(theCrc, *bufferPtr++);
     } while (--bufferSize);
+#endif
     
     return( theCrc);
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          gsebus_crc_calc
+ *  FUNCTIONAL DESCRIPTION: Calculate the CRC of an "object", as
+ *                          gsebus_crc_generate would add to it.
+ *  FORMAL PARAMETERS:      buf : Pointer to "object".
+ *                          sz  : Size of "object", (not zero).
+ *  RETURN VALUE:           CRC.
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+#pragma location="this_code_first"    /* Place near start of flash. */
+uint16_t gsebus_crc_calc(const void *buf, uint16_t sz)
+{
+    return CalcCrcRev(buf, sz);
+}
+
 /*
  ******************************************************************************
  *  FUNCTION NAME:          gsebus_crc_generate
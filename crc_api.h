@@ -25,8 +25,45 @@
 
 #define crc_overhead 2
 
+/*-- CRC kernel, chosen per build, eg. -DCRC_KERNEL=CRC_KERNEL_NIBBLE.      */
+/*   Table flash, and MSP430 cycles a byte for gsebus_crc_xxx, (estimated   */
+/*   from the instructions of each loop, wts_bench times them on the host): */
+/*       CRC_KERNEL_NIBBLE      32 bytes    ~35 cycles                      */
+/*       CRC_KERNEL_BYTE       512 bytes    ~15 cycles                      */
+/*       CRC_KERNEL_SLICE2    1024 bytes    ~9 cycles, two bytes at a time  */
+/*   crc_rev_step is the byte table for CRC_KERNEL_SLICE2 too.               */
+#define CRC_KERNEL_NIBBLE       (1)
+#define CRC_KERNEL_BYTE         (2)
+#define CRC_KERNEL_SLICE2       (3)
+
+#ifndef CRC_KERNEL
+#define CRC_KERNEL              CRC_KERNEL_BYTE
+#endif
+
+/*-- Single byte step of the (reversed) CRC-16 used on the gsebus.         */
+/*   For building a CRC up a byte at a time, eg. in the serial interrupts.  */
+/*   Carrying the CRC on over the (little endian) CRC bytes of a correct    */
+/*   "object" leaves the running CRC at zero.                               */
+#define crc_rev_init            (0xFFFF)
+
+#if CRC_KERNEL == CRC_KERNEL_NIBBLE
+#define CRC_TABLE_BYTES         (16 * sizeof(uint16_t))
+extern const uint16_t crc16_rev_nibble[16];
+uint16_t crc_rev_step_nibble(uint16_t crc, uint8_t ch);
+#define crc_rev_step(crc, ch)   crc_rev_step_nibble((crc), (ch))
+#elif CRC_KERNEL == CRC_KERNEL_BYTE || CRC_KERNEL == CRC_KERNEL_SLICE2
+#define CRC_TABLE_BYTES         ((CRC_KERNEL == CRC_KERNEL_SLICE2? 512: 256) \
+                                 * sizeof(uint16_t))
+extern const uint16_t crc16_rev_table[256];
+#define crc_rev_step(crc, ch)   \
+    (((crc) >> 8) ^ crc16_rev_table[((crc) ^ (ch)) & 0x00FF])
+#else
+#error Unknown CRC_KERNEL
+#endif
+
 /*-- As above but with little endian CRC's  */
 cfcl_results gsebus_crc_isInvalid(void *buf, uint16_t sz);
+uint16_t gsebus_crc_calc(const void *buf, uint16_t sz);
 void gsebus_crc_generate(void *buf, uint16_t sz);
 
 #endif /* __CRC_API_H__ */
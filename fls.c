@@ -22,9 +22,44 @@
 
 //#include "wfm_comms.h"
 #include "fls_api.h"
+#include "gsebus_ser.h"
+#include "crc_api.h"
 
 #define UNLOCK 0
 
+/*--- Background firmware block programming, see fls_fwug_cmd.        */
+/*    The block is programmed straight out of the Rx packet it came in, */
+/*    which comms_poll holds on to until fls_fwug_busy says it is done. */
+static struct {
+    const struct comms_fw_upgrade *cmd; /* Block in progress, NULL: idle. */
+    uint8_t  word;                      /* Next word of it to write.      */
+    const struct comms_fw_upgrade_z *zcmd; /* Compressed block, or NULL.  */
+    uint16_t zout;                      /* Next word of it to write.      */
+    uint16_t zsrc;                      /* Where a copy is coming from.   */
+    uint8_t  zin;                       /* Next byte of its data.         */
+    uint8_t  zrun;                      /* Bytes left of token.           */
+    uint8_t  zlit;                      /* Token is literals, (not copy). */
+    uint8_t  zfill;                     /* Bytes expanded into zbuf, for  */
+    uint8_t  zbuf[FLS_BG_WORDS * 2];    /* zout on, not yet written.      */
+    uint8_t  error;                     /* Error on an earlier block.     */
+    uint16_t error_addr;                /* (Its address.)                 */
+    uint16_t seg_done;                  /* New copy segments written and  */
+                                        /* verified, bit per segment.     */
+    uint16_t seg_fill;                  /* Where the segment being filled */
+                                        /* has got to, 0 if none.         */
+    uint8_t  started;                   /* NZ once a block is accepted.   */
+} fwug;
+
+/*-- Bit for the segment of the new copy an address is in, 0 if outside. */
+static uint16_t fls_seg_bit(uint16_t addr)
+{
+    if(addr < WTS_FW_NEW_COPY ||
+       addr - WTS_FW_NEW_COPY >= WTS_FW_SEGS * fls_segementSize){
+        return 0;
+    }
+    return 1 << ((addr - WTS_FW_NEW_COPY) / fls_segementSize);
+}
+
 /******************************************************************************/
 /* Note: Assumed to be running from flash. */
 void fls_init(void)
@@ -32,7 +67,7 @@ void fls_init(void)
     istate_t ist = __get_interrupt_state(); 
 
     __disable_interrupt(); 
-    FCTL2 = FWKEY | FSSEL_3 | 0x0011;
+    FCTL2 = FWKEY | FSSEL_3 | (FLS_CLK_DIV - 1);
     __set_interrupt_state(ist); 
 }
 
@@ -53,7 +88,8 @@ void fls_erase(const uint16_t *seg)
 
 /******************************************************************************/
 /* Note: Assumed to be running from flash. */
-/*       Block write function is not available when running from flash. */
+/*       Block write function is not available when running from flash, */
+/*       see fls_write_block.                                            */
 void fls_write(const uint16_t *dst, void *src, uint16_t nWords) {
     uint8_t *s = src;
     uint16_t val;
@@ -72,42 +108,387 @@ void fls_write(const uint16_t *dst, void *src, uint16_t nWords) {
     } while (--nWords);
 }
 
+/******************************************************************************/
+/* Note: Runs from RAM, flash cannot be read during a block write.       */
+/*       Call with interrupts off.  Stops early if a char comes in, so   */
+/*       the Rx interrupt is not kept waiting past the next one.         */
+/*       No function calls, (or library helpers), from here.             */
+__ramfunc static uint8_t fls_write_block_ram(uint16_t *dst,
+                                             const uint8_t *src,
+                                             uint8_t nWords)
+{
+    uint8_t done = 0;
+
+    FCTL3 = FWKEY | UNLOCK;
+    FCTL1 = FWKEY | BLKWRT | WRT;
+    do {
+        *dst++ = src[0] | (src[1] << 8);
+        src += 2;
+        done++;
+        while(!(FCTL3 & WAIT));         /* Ready for the next word.     */
+    } while(done < nWords && !(IFG1 & URXIFG0));
+    FCTL1 = FWKEY;                      /* End of block.                */
+    while(FCTL3 & BUSY);
+    FCTL3 = FWKEY | LOCK;
+    return done;
+}
+
 /*
  ******************************************************************************
- *  FUNCTION NAME:          fls_fwug_cmd
- *  FUNCTIONAL DESCRIPTION: Flash Firmware upgrade command.
- *  FORMAL PARAMETERS:      upgd    : Upgrade comms command.
- *  RETURN VALUE:           error code: Z if all OK, error code on problem.
- *  SIDE EFFECTS:           Will erase whole flash block if dest address is
- *                          on flash boundary.
+ *  FUNCTION NAME:          fls_write_block
+ *  FUNCTIONAL DESCRIPTION: Write to flash in block write mode, which takes
+ *                          21 flash timing cycles a word to fls_write's 35,
+ *                          up to the end of the 64 byte row dst is in.
+ *  FORMAL PARAMETERS:      dst     : Where in flash, (erased).
+ *                          src     : Data, in RAM, any alignment.
+ *                          nWords  : Words to write.
+ *  RETURN VALUE:           Words written.  Fewer than nWords at the end of
+ *                          the row, or if a char came in part way.
+ *  SIDE EFFECTS:           Interrupts off for FLS_BLK_CYCLES(words).
  ******************************************************************************
  */
-uint8_t fls_fwug_cmd(struct comms_fw_upgrade *cmd)
+uint8_t fls_write_block(const uint16_t *dst, const void *src, uint8_t nWords)
 {
-    extern void __program_start;
+    uint8_t row_left = (FLS_ROW_SIZE - ((uint16_t)dst & (FLS_ROW_SIZE - 1))) / 2;
+    istate_t ist = __get_interrupt_state();
+    uint8_t done;
+
+    if(nWords > row_left){
+        nWords = row_left;
+    }
+    if(nWords == 0){
+        return 0;
+    }
+    __disable_interrupt();
+    done = fls_write_block_ram((uint16_t *)dst, src, nWords);
+    __set_interrupt_state(ist);
+    return done;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_fwug_start
+ *  FUNCTIONAL DESCRIPTION: Checks common to each kind of firmware block,
+ *                          then erase its segment if it starts one.
+ *  FORMAL PARAMETERS:      addr    : Where the block goes.
+ *                          len     : Bytes it will write.
+ *                          ok      : NZ if the caller's own checks passed.
+ *  RETURN VALUE:           error code: Z if the block can go ahead.
+ *  SIDE EFFECTS:           Erases, see fls_fwug_cmd.
+ ******************************************************************************
+ */
+static uint8_t fls_fwug_start(uint16_t addr, uint16_t len, uint8_t ok)
+{
+    extern uint8_t __program_start;     /* Linker label, address only.  */
     const uint16_t prog_start = (uint16_t)&__program_start;
+    uint8_t error;
+
+    if(fwug.cmd != NULL || fwug.zcmd != NULL){  /* Still on the last?   */
+        return WTS_ERR_FWUG_BUSY;
+    }
+    if(fwug.error != 0){                /* Report earlier failure once. */
+        error = fwug.error;
+        fwug.error = 0;
+        return error;
+    }
+
     /* Check parameters. */
-    if( cmd->addr >= prog_start ||/* Could overwrite running code? */
-        cmd->addr + cmd->len >= prog_start ||
-        (cmd->addr & 1))
+    if( !ok ||
+        addr >= prog_start ||           /* Could overwrite running code? */
+        len > prog_start - addr ||      /* (Subtract, addr + len wraps.) */
+        (addr & 1))
     {
         return WTS_ERR_FWUG_BADADDR;
     }
 
     /*-- Erase segment if required. */
-    if(cmd->addr % fls_segementSize == 0){  /* Segment erase required?  */
-        fls_erase((void*)cmd->addr);
+    if(addr % fls_segementSize == 0){   /* Segment erase required?      */
+        fls_erase((void*)addr);
+        fwug.seg_fill = addr;           /* Fill it from the start.      */
     }
 
-    /*-- Write flash block.     */
-    fls_write((uint16_t *)(cmd->addr), cmd->data, cmd->len / 2);
+    /*-- Segment is only done once filled in order from its erase. */
+    fwug.seg_done &= ~fls_seg_bit(addr);
+    if(addr != fwug.seg_fill){
+        fwug.seg_fill = 0;
+    }
+    fwug.started = 1;
+    return 0;
+}
 
-    /*-- Verify flash block.    */
-    if(memcmp((void*)(cmd->addr), cmd->data, cmd->len) != 0){
-        return WTS_ERR_FWUG_WRFAIL;
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_fwug_cmd
+ *  FUNCTIONAL DESCRIPTION: Flash Firmware upgrade command.
+ *                          The block is checked, its segment erased if need
+ *                          be, then it is left to fls_state_machine to
+ *                          write a word at a time, and verify.
+ *  FORMAL PARAMETERS:      upgd    : Upgrade comms command, which must stay
+ *                                    put until fls_fwug_busy returns Z.
+ *  RETURN VALUE:           error code: Z if accepted, error code on problem.
+ *                          WTS_ERR_FWUG_WRFAIL if an earlier block failed
+ *                          verification (see fls_fwug_error_addr), in which
+ *                          case this one is not accepted.
+ *  SIDE EFFECTS:           Will erase whole flash block if dest address is
+ *                          on flash boundary.
+ *  Notes:                  The erase stalls the CPU (~11ms) so is done now,
+ *                          while the CCP is waiting for our response,
+ *                          rather than as the next block comes in.
+ ******************************************************************************
+ */
+uint8_t fls_fwug_cmd(const struct comms_fw_upgrade *cmd)
+{
+    uint8_t error = fls_fwug_start(cmd->addr, cmd->len,
+                                   cmd->len <= sizeof(cmd->data));
+
+    if(error == 0){                     /* Write and verify in the      */
+        fwug.word = 0;                  /* background.                  */
+        fwug.cmd  = cmd;
     }
+    return error;
+}
 
-    return 0;
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_fwug_z_cmd
+ *  FUNCTIONAL DESCRIPTION: Compressed flash firmware upgrade command.  As
+ *                          fls_fwug_cmd, but fls_state_machine expands the
+ *                          data (see WTS_DADR_FW_BLOCK_Z) as it writes, and
+ *                          checks the CRC of what it wrote.
+ *  FORMAL PARAMETERS:      cmd     : Upgrade comms command, which must stay
+ *                                    put until fls_fwug_busy returns Z.
+ *  RETURN VALUE:           As fls_fwug_cmd.
+ *  SIDE EFFECTS:           As fls_fwug_cmd.
+ ******************************************************************************
+ */
+uint8_t fls_fwug_z_cmd(const struct comms_fw_upgrade_z *cmd)
+{
+    uint8_t error;
+
+    /*-- Whole words, all in one segment, (checked without a sum that */
+    /*   could wrap).                                                 */
+    error = fls_fwug_start(cmd->addr, cmd->len,
+                           !(cmd->len & 1) && cmd->len != 0 &&
+                           cmd->len <= fls_segementSize -
+                               (cmd->addr & (fls_segementSize - 1)) &&
+                           cmd->zlen <= sizeof(cmd->data));
+    if(error == 0){
+        fwug.zout  = cmd->addr;
+        fwug.zin   = 0;
+        fwug.zrun  = 0;
+        fwug.zfill = 0;
+        fwug.zcmd  = cmd;
+    }
+    return error;
+}
+
+/*-- Firmware block written, note how it went. */
+static void fls_fwug_done(uint16_t addr, uint16_t len, uint8_t ok)
+{
+    if(!ok){
+        fwug.error      = WTS_ERR_FWUG_WRFAIL;
+        fwug.error_addr = addr;
+        fwug.seg_fill   = 0;
+    } else if(fwug.seg_fill == addr && fls_seg_bit(addr)){
+        uint16_t seg_start = addr & ~(fls_segementSize - 1);
+        fwug.seg_fill = addr + len;
+        if(fwug.seg_fill - seg_start >= fls_segementSize){
+            fwug.seg_done |= fls_seg_bit(seg_start);
+            fwug.seg_fill  = 0;         /* Segment complete.            */
+        }
+    }
+}
+
+/*-- Next byte of compressed data, or 0xFF once past zlen, so a bad */
+/*   block can never read beyond its data.                          */
+static uint8_t fls_z_in(void)
+{
+    if(fwug.zin >= fwug.zcmd->zlen){
+        return 0xFF;
+    }
+    return fwug.zcmd->data[fwug.zin++];
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_z_byte
+ *  FUNCTIONAL DESCRIPTION: Next byte of the compressed block being written.
+ *  FORMAL PARAMETERS:      at      : Address the byte is for.
+ *  RETURN VALUE:           The byte.
+ *  Notes:                  Copies come from flash already written, or from
+ *                          zbuf for bytes expanded but not yet written.
+ *                          Data that runs short just gives 0xFF, for the
+ *                          CRC check to find.
+ ******************************************************************************
+ */
+static uint8_t fls_z_byte(uint16_t at)
+{
+    uint8_t c;
+
+    if(fwug.zrun == 0){                 /* Next token.                  */
+        if(fwug.zin >= fwug.zcmd->zlen){
+            return 0xFF;
+        }
+        c = fls_z_in();
+        fwug.zlit = (c < WTS_FWZ_SHORT);
+        if(fwug.zlit){
+            fwug.zrun = c + 1;
+        } else {
+            uint16_t back = fls_z_in() + 1;
+            if(c < WTS_FWZ_LONG){
+                fwug.zrun = (c & WTS_FWZ_LEN_MASK) + WTS_FWZ_SHORT_MIN;
+            } else {
+                back += fls_z_in() << 8;
+                fwug.zrun = (c & WTS_FWZ_LEN_MASK) + WTS_FWZ_LONG_MIN;
+            }
+            fwug.zsrc = at - back;
+        }
+    }
+    fwug.zrun--;
+    if(fwug.zlit){
+        return fls_z_in();
+    }
+    if(fwug.zsrc >= fwug.zout){
+        c = fwug.zbuf[fwug.zsrc - fwug.zout];
+    } else {
+        c = *(uint8_t *)fwug.zsrc;
+    }
+    fwug.zsrc++;
+    return c;
+}
+
+/*-- fls_state_machine for a compressed block, up to FLS_BG_WORDS words */
+/*   per call, expanded into zbuf then written from there.              */
+static void fls_z_state_machine(void)
+{
+    const struct comms_fw_upgrade_z *cmd = fwug.zcmd;
+    uint16_t end = cmd->addr + cmd->len;
+    uint8_t fill = fwug.zfill;
+    uint8_t done;
+
+    if(fwug.zout < end){
+        if(ser_rx_can_stall(FLS_BLK_CYCLES(1))){
+            while(fill < sizeof(fwug.zbuf) && fwug.zout + fill < end){
+                fwug.zbuf[fill] = fls_z_byte(fwug.zout + fill);
+                fill++;
+            }
+            done = 2 * fls_write_block((uint16_t *)fwug.zout, fwug.zbuf,
+                                       fill / 2);
+            fwug.zout += done;          /* Keep what is left for next.  */
+            fill      -= done;
+            memmove(fwug.zbuf, &fwug.zbuf[done], fill);
+            fwug.zfill = fill;
+        }
+        return;
+    }
+
+    /*-- Check what was written. */
+    fls_fwug_done(cmd->addr, cmd->len,
+                  gsebus_crc_calc((void *)cmd->addr, cmd->len) == cmd->crc);
+    fwug.zcmd = NULL;                   /* Done with it.                */
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_state_machine
+ *  FUNCTIONAL DESCRIPTION: Carry on with a firmware block accepted by
+ *                          fls_fwug_cmd, up to FLS_BG_WORDS words per call,
+ *                          then verify it.
+ *                          Call from main loop.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           A block write holds interrupts off for up to
+ *                          FLS_BLK_CYCLES(FLS_BG_WORDS), so it waits while
+ *                          a packet is coming in at a rate where chars
+ *                          would be lost, and stops early if one arrives.
+ ******************************************************************************
+ */
+void fls_state_machine(void)
+{
+    const struct comms_fw_upgrade *cmd = fwug.cmd;
+    uint8_t word = fwug.word;
+
+    if(fwug.zcmd != NULL){
+        fls_z_state_machine();
+        return;
+    }
+    if(cmd == NULL){                    /* Nothing to do?               */
+        return;
+    }
+    if(word < cmd->len / 2){            /* Write next words.            */
+        if(ser_rx_can_stall(FLS_BLK_CYCLES(1))){
+            uint8_t n = cmd->len / 2 - word;
+            if(n > FLS_BG_WORDS){
+                n = FLS_BG_WORDS;
+            }
+            fwug.word = word + fls_write_block((uint16_t *)(cmd->addr) + word,
+                                               &cmd->data[word * 2], n);
+        }
+        return;
+    }
+
+    /*-- Verify flash block.    */
+    fls_fwug_done(cmd->addr, cmd->len,
+                  memcmp((void*)(cmd->addr), cmd->data, cmd->len) == 0);
+    fwug.cmd = NULL;                    /* Done with it.                */
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_fwug_seg_map
+ *  FUNCTIONAL DESCRIPTION: Report which segments of the new copy have been
+ *                          written and verified since start up, so an
+ *                          interrupted download can carry on.
+ *  FORMAL PARAMETERS:      resume : Where to put the address the segment
+ *                                   being filled has got to, 0 if none.
+ *  RETURN VALUE:           Bit n set for segment n (WTS_FW_NEW_COPY + n *
+ *                          fls_segementSize) done.
+ *  SIDE EFFECTS:           None 
+ *  Notes:                  RAM only, so lost on reset.  The segment CRCs
+ *                          (reflash_seg_crc) still tell which are right.
+ ******************************************************************************
+ */
+uint16_t fls_fwug_seg_map(uint16_t *resume)
+{
+    *resume = fwug.seg_fill;
+    return fwug.seg_done;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_fwug_busy
+ *  FUNCTIONAL DESCRIPTION: Test if a firmware block is still being written.
+ *  RETURN VALUE:           NZ if so, the block must be left where it is.
+ ******************************************************************************
+ */
+uint8_t fls_fwug_busy(void)
+{
+    return fwug.cmd != NULL || fwug.zcmd != NULL;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_fwug_started
+ *  FUNCTIONAL DESCRIPTION: Test if a download has started since start up,
+ *                          so the new copy is no longer what it was.
+ *  RETURN VALUE:           NZ if a firmware block has been accepted.
+ ******************************************************************************
+ */
+uint8_t fls_fwug_started(void)
+{
+    return fwug.started;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fls_fwug_error_addr
+ *  FUNCTIONAL DESCRIPTION: Address of the block that failed verification,
+ *                          valid once fls_fwug_cmd has reported it.
+ ******************************************************************************
+ */
+uint16_t fls_fwug_error_addr(void)
+{
+    return fwug.error_addr;
 }
 
 /******************************************************************************/
@@ -27,11 +27,38 @@
 #define fls_segementSize        (512)
 #define fls_segementSizeInWords (512/2)
 
+/*-- Flash timing generator is SMCLK / 18 (fls_init), (444kHz).  */
+/*   A word write takes 35 of its cycles, with the CPU stalled.  */
+#define FLS_CLK_DIV             (0x0011 + 1)
+#define FLS_WORD_CYCLES         (35 * FLS_CLK_DIV)
+
+/*-- A block write (fls_write_block) is within one 64 byte row, and   */
+/*   takes 30 cycles for the first word, 21 for each after, and 6 to  */
+/*   finish, with interrupts off throughout.                           */
+#define FLS_ROW_SIZE            (64)
+#define FLS_BLK_CYCLES(words)   ((30 + 21 * ((words) - 1) + 6) * FLS_CLK_DIV)
+
+/*-- A segment erase takes 4819 of its cycles, (~11ms, 86742 SMCLK     */
+/*   cycles, more than a uint16_t), with the CPU stalled.               */
+#define FLS_ERASE_CYCLES        (4819UL * FLS_CLK_DIV)
+
+/*-- Words per background block write.  Interrupts are off for */
+/*   FLS_BLK_CYCLES of it, keep that inside the 250us solenoid  */
+/*   interrupt period.                                          */
+#define FLS_BG_WORDS            (3)
+
 void fls_init( void);
 void fls_InterruptAccess( cfcl_boolean value);
 void fls_erase(const uint16_t *seg);
 void fls_write(const uint16_t *dst, void *src, uint16_t nWords);
+uint8_t fls_write_block(const uint16_t *dst, const void *src, uint8_t nWords);
 
-uint8_t fls_fwug_cmd(struct comms_fw_upgrade *cmd);
+uint8_t fls_fwug_cmd(const struct comms_fw_upgrade *cmd);
+uint8_t fls_fwug_z_cmd(const struct comms_fw_upgrade_z *cmd);
+void fls_state_machine(void);
+uint8_t fls_fwug_busy(void);
+uint8_t fls_fwug_started(void);
+uint16_t fls_fwug_error_addr(void);
+uint16_t fls_fwug_seg_map(uint16_t *resume);
 
 #endif /* __FLS_API_H__ */
@@ -34,39 +34,191 @@
 #include "globals.h"
 
 /******************************************************************************/
-#define BAUD (57600)
-
 #define  RS485TXDIR() (P3OUT  &=~P3O3_N_TX_ENABLE)
 #define  RS485RXDIR() (P3OUT |= P3O3_N_TX_ENABLE)
 
 #define  COMMS_STAT_LED_ON()  (P3OUT &= ~P3O6_N_LED_COMMS_STATUS)
 #define  COMMS_STAT_LED_OFF() (P3OUT |= P3O6_N_LED_COMMS_STATUS)
 
-#define SER_TXPKT_GUARDTIME rtc_8ms    /* Rx -> Tx delay.                  */
-//#define SER_TXPKT_GUARDTIME (rtc_nodelay) /* Rx -> Tx delay.                  */
-#define SER_RX_CH_TIMEOUT   rtc_8ms     /* Timout between Rx chars for      */
+/*--- Line turnaround timing, in bit times at the current baud rate.   */
+/*    (One char is 10 bit times: start, 8 data, stop.)                  */
+#define SER_TXPKT_GUARD_BITS    (20)    /* Rx -> Tx delay.                  */
+#define SER_TX_SETTLE_BITS      (1)     /* RS485 driver on -> first start bit*/
+#define SER_TX_HOLD_BITS        (0)     /* Last stop bit -> RS485 released. */
+#define SER_TX_DRAIN_BITS       (20)    /* Last TXBUF0 load -> line idle.   */
+                                        /* (TXBUF0 plus shift register.)    */
+
+#if ((SER_TX_DRAIN_BITS + SER_TX_HOLD_BITS) * 139UL > 0xFFFF) || \
+    (SER_TXPKT_GUARD_BITS * 139UL > 0xFFFF)
+#error "Serial bit time counts too big for 16 bit timer cycles at 57600"
+#endif
+
+/*--- The Rx inter character timeout is a fixed time, not bit times, so   */
+/*    a master that pauses between bytes (USB adaptors, PC schedulers)    */
+/*    is not cut off at the faster rates.  8ms is the old rtc_8ms tick.  */
+#define SER_RX_CH_TIMEOUT_MS    (8)     /* Timout between Rx chars for      */
                                         /* incomplete packet test.          */
-//#define SER_TX_HOLDTIME     rtc_8ms     
-//#define SER_TX_HOLDTIME     (0)         /* Small delay.                   */
-#define SER_TX_HOLDTIME     (rtc_nodelay) /* No delay.                      */
+#define SER_RX_CH_TIMEOUT_CYCLES (SER_RX_CH_TIMEOUT_MS * 8000U) /* @8MHz.  */
+
+#if (SER_RX_CH_TIMEOUT_MS * 8000UL > 0xFFFF)
+#error "Rx char timeout too big for 16 bit timer cycles"
+#endif
+
+/*--- The turnaround timers are one shot compares on Timer B, which      */
+/*    free runs at SMCLK (8MHz, so 125ns resolution) as a 12 bit counter */
+/*    for the PWM outputs, see timers.c.  Longer delays count whole      */
+/*    wraps of the counter before the final compare.                     */
+#define SER_TB_BITS             (12)
+#define SER_TB_MASK             ((1U << SER_TB_BITS) - 1)
+#define SER_TB_MIN_CYCLES       (48)    /* Margin to get compare set up.    */
 
 #define SER_TX_IND_LIGHT_TIME     rtc_90ms
 #define SER_CCP_MSG_TIMEOUT       rtc_30s
+#define SER_BAUD_COMMIT_TIME      rtc_2s    /* To get a good pkt at new baud*/
+
+#define SER_BAUD_NONE             (0xFF)    /* No baud rate change pending. */
+
+/*--- UART divider and modulation settings, indexed by WTS_BAUD_xxx.   */
+/*    BRCLK = SMCLK = 8MHz.                                            */
+struct ser_baud_setting{
+    uint8_t ubr0;       /* Divider low byte.    */
+    uint8_t ubr1;       /* Divider high byte.   */
+    uint8_t umctl;      /* Modulation pattern.  */
+    uint8_t bit_cycles; /* SMCLK cycles per bit (rounded).  */
+};
+
+static const struct ser_baud_setting ser_baud_settings[WTS_BAUD_RATES] = {
+    /* UBR10+UBR00 = 0x008b from 8M/57600=138.88 139=0x8b              */
+    /* frc=SUM(00001111)/8=4/8=0.5 from example.                       */
+    { 0x8b, 0x00, 0x0F, 139 },
+    /* UBR10+UBR00 = 0x0045 from 8M/115200=69.44 69=0x45               */
+    /* frc=SUM(10101010)/8=4/8=0.5 (spread evenly over the char).      */
+    { 0x45, 0x00, 0xAA,  69 },
+    /* UBR10+UBR00 = 0x0022 from 8M/230400=34.72 34=0x22               */
+    /* frc=SUM(11011101)/8=6/8=0.75                                    */
+    { 0x22, 0x00, 0xDD,  35 },
+};
 
 
 /*-- Here be the dreaded globals. */
-static uint8_t rxtx_buf[256];  /* Combined Receive and Transmit buffer */
-static volatile uint8_t rx_index;
+/*   Receive and transmit have separate buffers so the receiver can stay   */
+/*   armed while a response is formed and sent.  The receiver has two      */
+/*   frame buffers: one is filled by ser_rxIsr while the other holds a     */
+/*   complete frame waiting for (or being processed by) comms_poll.        */
+/*   The buffers are 256 bytes so a uint8_t index can never overrun them.  */
+#define SER_RX_FRAMES       (2)
+#define SER_TX_PAYLOAD_END  (256 - 3)   /* Tx payload stops short of CRC, ETX*/
+
+/*-- Frames start word aligned, so the data after the location ID (index */
+/*   6) can be read as words in place.                                   */
+#pragma data_alignment=2
+static uint8_t rx_buf[SER_RX_FRAMES][256];  /* Receive frame buffers.    */
+static uint8_t tx_buf[256];                 /* Transmit buffer.          */
+static volatile uint8_t rx_index;   /* Write index into rx_buf[rx_head]. */
+static volatile uint16_t rx_crc;    /* Running CRC of frame being rx'ed. */
+static uint16_t rx_frame_crc[SER_RX_FRAMES];/* Final CRC, 0 if frame OK.  */
+static volatile uint8_t rx_head;    /* Frame being filled by ser_rxIsr.  */
+static volatile uint8_t rx_queued;  /* Complete frames held (0..2).      */
+static uint8_t rx_tail;             /* Oldest complete frame (main only).*/
+static uint8_t rx_in_use;           /* NZ while comms_poll owns rx_tail. */
 static volatile uint8_t tx_index;
 static volatile uint8_t tx_size;
+static volatile uint8_t tx_crc_end; /* Where ser_txIsr puts the CRC.     */
+static uint8_t tx_item;             /* Start of batch item, 0 if none.   */
+static uint8_t tx_overflow;         /* NZ if response too big for tx_buf.*/
+static volatile uint16_t tx_crc;    /* Running CRC of bytes sent so far. */
+static uint8_t ser_baud;            /* Current WTS_BAUD_xxx code.        */
+static uint8_t ser_baud_pending;    /* Rate to switch to after Tx.       */
+static uint8_t ser_baud_committed;  /* NZ once good pkt seen at ser_baud.*/
+static volatile uint8_t tx_tb_wraps;/* Whole Timer B wraps left (Tx).    */
+static volatile uint8_t rx_tb_wraps;/* Whole Timer B wraps left (Rx).    */
+
+/*--- Turnaround times in SMCLK cycles, worked out for the baud rate in   */
+/*    use by ser_timing_set, so the interrupts need not multiply.         */
+static struct {
+    uint16_t bit;               /* One bit time.                        */
+    uint16_t guard;             /* Rx -> Tx delay.                      */
+    uint16_t settle;            /* RS485 driver on -> Tx start.         */
+    uint16_t drain;             /* Last TXBUF0 load -> RS485 released.  */
+} ser_cycles;
+
+/*   tx_index and tx_size also contain the state of the transmitter.    */
+
+/*   If tx_size == 0 then tx'er is idle.                                */
+/*   If tx_size > 0  && tx_index == 0 then in pre tx delay.             */
+/*   If tx_size > 0  && tx_index < tx_size then tx is in progress.      */
+/*   If tx_size > 0  && tx_index >= tx_size then in post tx delay.      */
+/*   Moving between these states is driven by ser_tx_tirq, called from  */
+/*   the Timer B compare 2 interrupt, so there is no wait for the next  */
+/*   systick.  Likewise ser_rx_tirq (Timer B compare 3) times out a     */
+/*   part received packet.                                              */
+
+/*   The CRC of both Rx and Tx frames is worked out a byte at a time in  */
+/*   the serial interrupts, so no pass over the whole frame is needed    */
+/*   once a frame is received, or before it is sent.                     */
+
+/*   rx_queued is only incremented by ser_rxIsr, and only decremented   */
+/*   (with interrupts off) by gsebus_rx_pkt once a frame is finished    */
+/*   with.  While rx_queued == SER_RX_FRAMES the receiver discards new  */
+/*   frames as there is no buffer to put them in.                       */
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ser_timing_set
+ *  FUNCTIONAL DESCRIPTION: Convert the line turnaround times from bit times
+ *                          to SMCLK cycles for a given baud rate.
+ *  FORMAL PARAMETERS:      code : WTS_BAUD_xxx code of rate in use.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           ser_cycles updated.
+ ******************************************************************************
+ */
+static void ser_timing_set(uint8_t code)
+{
+    uint16_t bit = ser_baud_settings[code].bit_cycles;
+
+    ser_cycles.bit           = bit;
+    ser_cycles.guard         = SER_TXPKT_GUARD_BITS * bit;
+    ser_cycles.settle        = SER_TX_SETTLE_BITS * bit;
+    ser_cycles.drain         = (SER_TX_DRAIN_BITS + SER_TX_HOLD_BITS) * bit;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ser_tx_timer_start / ser_rx_timer_start
+ *  FUNCTIONAL DESCRIPTION: Start a one shot turnaround timer.
+ *                          ser_tx_tirq or ser_rx_tirq is called once the
+ *                          time is up.
+ *  FORMAL PARAMETERS:      cycles : Delay in SMCLK cycles.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           Any earlier timing on the same timer is lost.
+ *  Notes:                  Called from ISRs, no multiplication.
+ *                          Delays below SER_TB_MIN_CYCLES are stretched to
+ *                          it (6us at 8MHz).
+ ******************************************************************************
+ */
+static void ser_tx_timer_start(uint16_t cycles)
+{
+    uint16_t lo = cycles & SER_TB_MASK;
 
-/*   tx_index and tx_size also contain the state of the transmitter */
-/*   and reciever.                                                  */
+    if(lo < SER_TB_MIN_CYCLES){
+        lo = SER_TB_MIN_CYCLES;
+    }
+    tx_tb_wraps = cycles >> SER_TB_BITS;
+    TBCCR2  = (TBR + lo) & SER_TB_MASK;
+    TBCCTL2 = CCIE;                 /* Compare mode, clears any old CCIFG.  */
+}
+
+static void ser_rx_timer_start(uint16_t cycles)
+{
+    uint16_t lo = cycles & SER_TB_MASK;
 
-/*   If tx_size == 0 then tx'er is idle.  (Rx mode.)                */
-/*   If tx_size > 0  && tx_index == 0 then                          */
-/*   If tx_size > 0  && tx_index < tx_size then tx is in progress.  */
-/*   If tx_size > 0  && tx_index >= tx_size then in post tx delay.  */
+    if(lo < SER_TB_MIN_CYCLES){
+        lo = SER_TB_MIN_CYCLES;
+    }
+    rx_tb_wraps = cycles >> SER_TB_BITS;
+    TBCCR3  = (TBR + lo) & SER_TB_MASK;
+    TBCCTL3 = CCIE;                 /* Compare mode, clears any old CCIFG.  */
+}
 
 void ser_init( void) 
 {
@@ -79,20 +231,18 @@ void ser_init( void)
        8 bit, one stop bit, odd parity, parity disable */
     UCTL0  = CHAR;
 
-#if BAUD == 57600
-    /* UBR10+UBR00 = 0x008b from 8M/57600=138.88 139=0x8b */
-    UBR00  = 0x8b;
-    UBR10  = 0x00;    
-#elif BAUD = 115200
-    /* UBR10+UBR00 = 0x0045 from 8M/115200=69.44 69=0x45 */
-    UBR00  = 0x45;
-    UBR10  = 0x00;    
-#else
-#error Unhandled baud rate.
-#endif
-    /* frc=SUM(00001111)/8=4/8=0.5 from example, 
-       Baud Rate=BRCLK/(UBR+frc)=115K1Hz ( CRO measurement = ~116KHz)*/
-    UMCTL0 = 0x0F;    
+    /* Always start up at the default baud rate.  The CCP can ask for a
+       faster one via WTS_DADR_BAUD_RATE.
+       Baud Rate=BRCLK/(UBR+frc) */
+    UBR00  = ser_baud_settings[WTS_BAUD_DEFAULT].ubr0;
+    UBR10  = ser_baud_settings[WTS_BAUD_DEFAULT].ubr1;
+    UMCTL0 = ser_baud_settings[WTS_BAUD_DEFAULT].umctl;
+    ser_baud           = WTS_BAUD_DEFAULT;
+    ser_baud_pending   = SER_BAUD_NONE;
+    ser_baud_committed = 1;
+    ser_timing_set(WTS_BAUD_DEFAULT);
+    TBCCTL2 = 0;                            /* Turnaround timers stopped.   */
+    TBCCTL3 = 0;
 
     /* UCLKI=UCLK, BRCLK=SMCLK=8M, 
        no URXS signal,mul.proc.com.feature,set when transmit empty */
@@ -112,57 +262,129 @@ void ser_init( void)
     /* USART0 Tx and Rx  module enable  */
     ME1   |= (UTXIFG0 | URXIFG0);
     
-    /* USART0 Rx Interrupt enable  */
+    rx_index  = 0;
+    rx_head   = 0;
+    rx_queued = 0;
+    rx_tail   = 0;
+    rx_in_use = 0;
+    tx_index  = 0;
+    tx_size   = 0;
+
+    /* USART0 Rx Interrupt enable.  (Stays enabled from here on.) */
     IE1   |= (URXIE0); 
-    
+    __enable_interrupt();
+}
+
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ser_baud_apply
+ *  FUNCTIONAL DESCRIPTION: Reprogram the UART for a new baud rate.
+ *  FORMAL PARAMETERS:      code : WTS_BAUD_xxx code of rate required.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           Any part received packet is thrown away.
+ *  Notes:                  Only call with the transmitter idle.
+ ******************************************************************************
+ */
+static void ser_baud_apply(uint8_t code)
+{
+    const struct ser_baud_setting *setting = &ser_baud_settings[code];
+
+    __disable_interrupt();
+    UCTL0 |= SWRST;                 /* Hold USART in reset to change rate.  */
+    UBR00  = setting->ubr0;
+    UBR10  = setting->ubr1;
+    UMCTL0 = setting->umctl;
+    UCTL0 &= ~SWRST;
+    IE1   |= URXIE0;                /* (SWRST clears the interrupt enable.) */
     rx_index = 0;
-    tx_index = 0;
-    tx_size  = 0;
+    TBCCTL3  = 0;                   /* No part packet to time out.          */
+    ser_timing_set(code);
     __enable_interrupt();
+
+    ser_baud = code;
+    ser_baud_committed = (code == WTS_BAUD_DEFAULT);
+    rtc_tickDelay(rtc_ser_baud, SER_BAUD_COMMIT_TIME);
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ser_baud_request
+ *  FUNCTIONAL DESCRIPTION: Request a change of baud rate.  The change takes
+ *                          place once the response to the current packet
+ *                          has been sent.
+ *  FORMAL PARAMETERS:      code : WTS_BAUD_xxx code of rate required.
+ *  RETURN VALUE:           Z if accepted, WTS_ERR_BAUD_RATE if not.
+ *  SIDE EFFECTS:           None
+ ******************************************************************************
+ */
+uint8_t ser_baud_request(uint8_t code)
+{
+    if(code >= WTS_BAUD_RATES){
+        return WTS_ERR_BAUD_RATE;
+    }
+    if(code != ser_baud){
+        ser_baud_pending = code;
+    }
+    return 0;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ser_baud_get
+ *  FUNCTIONAL DESCRIPTION: Report the baud rate in use.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           WTS_BAUD_xxx code.
+ *  SIDE EFFECTS:           None
+ ******************************************************************************
+ */
+uint8_t ser_baud_get(void)
+{
+    return ser_baud;
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ser_rx_can_stall
+ *  FUNCTIONAL DESCRIPTION: Test if the CPU can be held up, with interrupts
+ *                          off, without losing received chars.  That is no
+ *                          packet is coming in, or the chars are coming
+ *                          slower than the hold up.
+ *  FORMAL PARAMETERS:      cycles : Length of hold up in SMCLK cycles.
+ *  RETURN VALUE:           NZ if OK to stall.
+ *  SIDE EFFECTS:           None
+ *  Notes:                  A packet can still start just as the stall does,
+ *                          its CRC catches any lost chars.
+ ******************************************************************************
+ */
+uint8_t ser_rx_can_stall(uint32_t cycles)
+{
+    return rx_index == 0 || cycles < 10 * ser_cycles.bit;
+}
 
 /*
  ******************************************************************************
  *  FUNCTION NAME:          ser_state_machine
  *  FUNCTIONAL DESCRIPTION: Should be periodically called for serial comms
- *                          maintenance.
+ *                          maintenance.  Done by gsebus_rx_pkt, so only
+ *                          needs calling while that is not being called.
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           None 
  ******************************************************************************
  */
-static void ser_state_machine(void)
+void ser_state_machine(void)
 {
-    uint8_t tmp_tx_sz, tmp_tx_idx;      /* Local copies of global volatiles */
-
-    tmp_tx_sz = tx_size;
-    
-    if(tmp_tx_sz == 0){                         /* In Rx mode?              */
-        if(rx_index != 0){                      /* Part of a packet seen?   */
-            if(rtc_expired(rtc_ser_timeout)){   /* Gap between chars to big?*/
-                rx_index = 0;                   /* Time out on packet rx.   */
-            }
-        }
-    } else {                                    /* Some form of Tx mode.    */
-        tmp_tx_idx = tx_index;                  /* Copy the volatile.   */
-        if(tmp_tx_idx == 0){                    /* Pre Tx delay?            */
-            if(rtc_expired(rtc_ser_timeout)){   /* Delay time up?           */
-                RS485TXDIR();                   /* RS485 buffer outward.    */
-                burnCPUCycles(1);               /* Settle delay.            */
-                IE1 |= UTXIE0;                  /* Start txing.             */
-                /* (The interrupt should kick system out of this state)     */
-            }
-        } else if(tmp_tx_idx >= tmp_tx_sz){     /* In post Tx delay?        */
-            if(rtc_expired(rtc_ser_timeout)){   /* Delay time up?           */
-                if(UTCTL0 & TXEPT){             /* Final byte gone?         */
-                   RS485RXDIR();                /* Turn RS485 back inbound. */
-                   tx_size=0;                   /* Back into Rx state.      */
-                   tx_index=0;
-                   rx_index=0;
-                   RXBUF0;                      /* Discard any junk RX char.*/
-                   IE1 |= URXIE0;                /* Enable Rx'er interrupt.  */
-                }
+    if(tx_size == 0){                           /* Tx idle?                 */
+        if(ser_baud_pending != SER_BAUD_NONE){  /* Rate change after reply? */
+            ser_baud_apply(ser_baud_pending);
+            ser_baud_pending = SER_BAUD_NONE;
+        } else if(ser_baud != WTS_BAUD_DEFAULT){/* At fast rate?            */
+            /*-- Fall back if the CCP never talked to us at the new rate,   */
+            /*   or has gone quiet (it may have been restarted).            */
+            if((!ser_baud_committed && rtc_expired(rtc_ser_baud)) ||
+               rtc_expired(rtc_msg_timeout)){
+                ser_baud_apply(WTS_BAUD_DEFAULT);
             }
         }
     }
@@ -174,13 +396,19 @@ static void ser_state_machine(void)
 /*
  ******************************************************************************
  *  FUNCTION NAME:          gsebus_rx_pkt
- *  FUNCTIONAL DESCRIPTION: Investigate the Rx buffer for complete "gsebus"
- *                          packet.  If found return pointer to packet data.
+ *  FUNCTIONAL DESCRIPTION: Look for a complete "gsebus" packet queued by
+ *                          the receive interrupt.  If found return pointer
+ *                          to packet data.
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           NULL if nothing new to interpret.
  *                          pointer to packet if found packet (with our
  *                          desination address).
- *  SIDE EFFECTS:           Background checking of timeouts for Rx Buffer.
+ *  SIDE EFFECTS:           Background serial house keeping.
+ *                          The packet returned by the previous call is
+ *                          released back to the receiver.
+ *  Notes:                  A queued packet is held until the transmitter is
+ *                          idle, as the response is formed in the (single)
+ *                          Tx buffer.
  ******************************************************************************
  */
 /*--- Offsets of items within Rx buffer. */
@@ -193,34 +421,37 @@ static void ser_state_machine(void)
 
 gsebus_header_t * gsebus_rx_pkt(void)
 {
+    uint8_t *pkt;
+
     /*--- First some house keeping. */
     ser_state_machine();
 
-    /*--- Then look at Rx buffer content. */
-    if(rx_index > GSEBUS_IDX_LEN){           /* Packet length valid?     */
-        uint8_t len = rxtx_buf[GSEBUS_IDX_LEN];
-        if(rx_index > len + 1) {            /* Complete packet? */
-            if(rxtx_buf[GSEBUS_IDX_TADR] != GSEBUS_ADDR_ID_WTS){
-                rx_index = 0;   /* Packet not for us, or framing bad. */
-                return NULL;
-            }
-            if(rxtx_buf[len + 1] != GSEBUS_ETX){
-                rx_index = 0;   /* Packet not for us, or framing bad. */
-                return NULL;
-            }
-            IE1 &= ~URXIE0;             /* Disable Rx interrupt.    */
-            rx_index = 0;
-            if(gsebus_crc_isInvalid(&rxtx_buf[1], len -2)){
-                gsebus_formtx_nack();
-                gsebus_formtx_finalise();
-                rx_index = 0;
-                wts_status.BadCrcCount++;   /* Maintain CRC error stats. */
-                return NULL;
-            }
-            return (gsebus_header_t *)&rxtx_buf[1];/* Have valid packet, pass it back. */
-        }
+    /*--- Hand back the packet we gave out last time. */
+    if(rx_in_use){
+        rx_in_use = 0;
+        rx_tail ^= 1;
+        __disable_interrupt();
+        rx_queued--;
+        __enable_interrupt();
+    }
+
+    /*--- Then look for a queued packet. */
+    if(rx_queued == 0){                 /* Nothing received?            */
+        return NULL;
     }
-    return NULL;
+    if(tx_size != 0){                   /* Still busy with last reply?  */
+        return NULL;
+    }
+    rx_in_use = 1;                      /* Released on next call.       */
+    pkt = rx_buf[rx_tail];
+    if(rx_frame_crc[rx_tail] != 0){     /* CRC folded in by ser_rxIsr.  */
+        gsebus_formtx_nack();
+        gsebus_formtx_finalise();
+        wts_status.BadCrcCount++;       /* Maintain CRC error stats.    */
+        return NULL;
+    }
+    ser_baud_committed = 1;             /* Baud rate proven to work.    */
+    return (gsebus_header_t *)&pkt[1];  /* Have valid packet, pass it back. */
 }
 
 /*
@@ -233,17 +464,26 @@ gsebus_header_t * gsebus_rx_pkt(void)
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           tx_size  set to 0 until whole packet formed.
  *                          tx_index reused as write pointer.
- *                          rxtx_buf filled in with response header
+ *                          tx_buf filled in with response header
+ *  Notes:                  Between gsebus_formtx_item_start and
+ *                          gsebus_formtx_item_end just the current item of
+ *                          a batched response is (re)started.
  ******************************************************************************
  */
 static void gsebus_formtx_start(uint8_t cmd)
 {
+    tx_overflow = 0;
+    if(tx_item != 0){                       /* Item of a batched response?  */
+        tx_buf[tx_item] = cmd;              /* Item has own ACK/NACK,       */
+        tx_index = tx_item + 2;             /* then length, then its data.  */
+        return;
+    }
     tx_size = 0;        /* Leave size at 0 until whole packet formed. */
 
-    gsebus_header_t *hdr = (gsebus_header_t *) &rxtx_buf[1];
+    gsebus_header_t *hdr = (gsebus_header_t *) &tx_buf[1];
 
-    rxtx_buf[GSEBUS_IDX_STX] = GSEBUS_STX;  /* Start of transmission char.  */
-    hdr->taddr = hdr->saddr;                /* Who we are responding to.    */
+    tx_buf[GSEBUS_IDX_STX] = GSEBUS_STX;    /* Start of transmission char.  */
+    hdr->taddr = rx_buf[rx_tail][GSEBUS_IDX_SADR];/* Who we respond to.     */
     hdr->saddr = GSEBUS_ADDR_ID_WTS;        /* We sent this.                */
     hdr->cmd   = cmd;
     tx_index = GSEBUS_IDX_PAYLOAD;
@@ -257,7 +497,7 @@ static void gsebus_formtx_start(uint8_t cmd)
  *                          follow to send packet off.
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           None
- *  SIDE EFFECTS:           tx_index, tx_size, and rxtx_buf modified.
+ *  SIDE EFFECTS:           tx_index, tx_size, and tx_buf modified.
  *  Notes:                  A gsebus_formtx_ack call can follow a
  *                          gsebus_formtx_nack call if you need to change
  *                          your mind (to simplify the packet processing code)
@@ -275,7 +515,7 @@ void gsebus_formtx_nack(void)
  *  FUNCTIONAL DESCRIPTION: As above but also finalises packet.
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           None
- *  SIDE EFFECTS:           tx_index, tx_size, and rxtx_buf modified.
+ *  SIDE EFFECTS:           tx_index, tx_size, and tx_buf modified.
  *  Notes:                  A gsebus_formtx_ack call can follow a
  *                          gsebus_formtx_nack call if you need to change
  *                          your mind (to simplify the packet processing code)
@@ -297,7 +537,7 @@ void gsebus_tx_nack(void)
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           tx_size  set to 0 until whole packet formed.
  *                          tx_index reused as write pointer.
- *                          rxtx_buf   filled in with response header
+ *                          tx_buf     filled in with response header
  ******************************************************************************
  */
 void gsebus_formtx_ack(void)
@@ -321,7 +561,11 @@ void gsebus_formtx_ack(void)
  */
 void gsebus_formtx_add_uint8(uint8_t ch)
 {
-    rxtx_buf[tx_index++] = ch;
+    if(tx_index >= SER_TX_PAYLOAD_END){
+        tx_overflow = 1;
+        return;
+    }
+    tx_buf[tx_index++] = ch;
 }
 
 /*
@@ -337,8 +581,12 @@ void gsebus_formtx_add_uint8(uint8_t ch)
  */
 void gsebus_formtx_add_uint16(uint16_t wd)
 {
-    rxtx_buf[tx_index++] = wd;        /* Low byte.    */
-    rxtx_buf[tx_index++] = wd >> 8;   /* High byte.   */
+    if(tx_index >= SER_TX_PAYLOAD_END - 1){
+        tx_overflow = 1;
+        return;
+    }
+    tx_buf[tx_index++] = wd;          /* Low byte.    */
+    tx_buf[tx_index++] = wd >> 8;     /* High byte.   */
 }
 
 /*
@@ -354,7 +602,11 @@ void gsebus_formtx_add_uint16(uint16_t wd)
 void gsebus_formtx_add_cstr(const char *s)
 {
     do{
-        rxtx_buf[tx_index++] = *s;
+        if(tx_index >= SER_TX_PAYLOAD_END){
+            tx_overflow = 1;
+            return;
+        }
+        tx_buf[tx_index++] = *s;
     } while(*s++);
 }
 
@@ -370,8 +622,12 @@ void gsebus_formtx_add_cstr(const char *s)
  */
 void gsebus_formtx_add_zero_fill(uint8_t sz)
 {
+    if(sz > SER_TX_PAYLOAD_END - tx_index){
+        tx_overflow = 1;
+        return;
+    }
     do{
-        rxtx_buf[tx_index++] = 0;
+        tx_buf[tx_index++] = 0;
     } while(--sz);
 }
 
@@ -389,17 +645,74 @@ void gsebus_formtx_add_zero_fill(uint8_t sz)
 void gsebus_formtx_add_mem(void *src, uint8_t sz)
 {
     uint8_t *s = src;
+    if(sz > SER_TX_PAYLOAD_END - tx_index){
+        tx_overflow = 1;
+        return;
+    }
     do{
-        rxtx_buf[tx_index++] = *s++;
+        tx_buf[tx_index++] = *s++;
     } while(--sz);
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          gsebus_formtx_item_start
+ *  FUNCTIONAL DESCRIPTION: Start an item of a batched response.
+ *                          Each item is laid out as:
+ *                              ACK or NACK
+ *                              Length of data that follows.
+ *                              Data, as the payload of a single response.
+ *                          The item starts as a NACK.  The normal response
+ *                          forming functions then fill in the item, with
+ *                          gsebus_formtx_ack/nack restarting just the item.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           NZ if there is no room left for another item.
+ *  SIDE EFFECTS:           None
+ ******************************************************************************
+ */
+uint8_t gsebus_formtx_item_start(void)
+{
+    if(tx_index > SER_TX_PAYLOAD_END - 2){  /* No room for even a NACK.   */
+        return 1;
+    }
+    tx_item = tx_index;
+    gsebus_formtx_start(GSEBUS_NACK);
+    return 0;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          gsebus_formtx_item_end
+ *  FUNCTIONAL DESCRIPTION: Finish an item of a batched response.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           NZ if the item did not fit, it is dropped.
+ *  SIDE EFFECTS:           None
+ ******************************************************************************
+ */
+uint8_t gsebus_formtx_item_end(void)
+{
+    uint8_t item = tx_item;
+
+    tx_item = 0;
+    if(tx_overflow){
+        tx_overflow = 0;
+        tx_index = item;                    /* Drop the whole item.         */
+        return 1;
+    }
+    tx_buf[item + 1] = tx_index - item - 2; /* Length of item data.         */
+    return 0;
+}
+
 /*
  ******************************************************************************
  *  FUNCTION NAME:          gsebus_formtx_end(void)
  *  FUNCTIONAL DESCRIPTION: Finish framing of packet and prepare for tx.
- *                          Adds CRC and End of frame char and queue for
- *                          sending.  Prime the timer for Rx->Tx delay.
+ *                          Adds End of frame char and queue for sending.
+ *                          Room is left for the CRC, which is filled in by
+ *                          ser_txIsr as the packet goes out.
+ *                          A response too big for the Tx buffer is
+ *                          turned into a NACK.
+ *                          Start the timer for Rx->Tx delay.
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           None 
@@ -407,16 +720,87 @@ void gsebus_formtx_add_mem(void *src, uint8_t sz)
  */
 void gsebus_formtx_finalise(void)
 {
-    rxtx_buf[GSEBUS_IDX_LEN] = tx_index + 1;/* Put length into packet header. */
-    gsebus_crc_generate(&rxtx_buf[1], tx_index -1);/* Add CRC to end of packet*/
+    if(tx_overflow){
+        gsebus_formtx_nack();
+    }
+    tx_buf[GSEBUS_IDX_LEN] = tx_index + 1;  /* Put length into packet header. */
+    tx_crc_end = tx_index;                  /* CRC goes after the payload.    */
+    tx_crc = crc_rev_init;
     tx_index += 2;                          /* Update Idx to include CRC.     */
-    rxtx_buf[tx_index++] = GSEBUS_ETX;      /* Append frame end char.         */
+    tx_buf[tx_index++] = GSEBUS_ETX;        /* Append frame end char.         */
     tx_size = tx_index;                     /* Switch to pre tx delay.        */
     tx_index = 0;
-    rtc_tickDelay(rtc_ser_timeout, SER_TXPKT_GUARDTIME);
-    /*-- This will go off as soon as the Rx -> Rx delay is satisfied.    */
+    __disable_interrupt();                  /* (TBR read to compare set.)     */
+    ser_tx_timer_start(ser_cycles.guard);
+    __enable_interrupt();
+    /*-- ser_tx_tirq starts the Tx once the Rx -> Tx delay is satisfied. */
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ser_tx_tirq
+ *  FUNCTIONAL DESCRIPTION: Tx turnaround timer expired.  Called from the
+ *                          Timer B compare 2 interrupt.
+ *                          Pre Tx:  turn the RS485 driver on, then after
+ *                                   the settle time start the Tx.
+ *                          Post Tx: once the last stop bit is gone turn
+ *                                   the RS485 driver off, Tx idle.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None
+ ******************************************************************************
+ */
+void ser_tx_tirq(void)
+{
+    if(tx_tb_wraps != 0){           /* Not there yet, compare is left as is */
+        tx_tb_wraps--;              /* so next match is one wrap later.     */
+        return;
+    }
+    TBCCTL2 = 0;                    /* One shot.                */
+
+    if(tx_size == 0){               /* (Stray, nothing to do.)  */
+        return;
+    }
+    if(tx_index == 0){                          /* Pre Tx delay?            */
+        if(P3OUT & P3O3_N_TX_ENABLE){           /* RS485 still inbound?     */
+            RS485TXDIR();                       /* RS485 buffer outward.    */
+            ser_tx_timer_start(ser_cycles.settle);  /* Settle delay.        */
+        } else {
+            IE1 |= UTXIE0;                      /* Start txing.             */
+        }
+    } else if(tx_index >= tx_size){             /* In post Tx delay?        */
+        if(UTCTL0 & TXEPT){                     /* Final byte gone?         */
+            RS485RXDIR();                       /* Turn RS485 back inbound. */
+            tx_size  = 0;                       /* Back into idle state.    */
+            tx_index = 0;
+        } else {
+            ser_tx_timer_start(ser_cycles.bit); /* Look again shortly.      */
+        }
+    }
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ser_rx_tirq
+ *  FUNCTIONAL DESCRIPTION: Rx inter character timer expired.  Called from
+ *                          the Timer B compare 3 interrupt.
+ *                          Throws away any part received packet.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None
+ ******************************************************************************
+ */
+void ser_rx_tirq(void)
+{
+    if(rx_tb_wraps != 0){
+        rx_tb_wraps--;
+        return;
+    }
+    TBCCTL3  = 0;                   /* One shot.                */
+    rx_index = 0;                   /* Time out on packet rx.   */
+}
+
+
 /*******************************************************************************
 NOTE :- Language extensions enabled for Interrupt Service Routines.
         Only ISR functions should appear after this comment block.
@@ -437,13 +821,36 @@ __interrupt void ser_rxIsr(void)
 {
     uint8_t rxChar = RXBUF0;
     uint8_t index = rx_index;
+    uint8_t *buf = rx_buf[rx_head];
 
     if(index==0) {                              /* Awaiting start char?     */
         if(rxChar != GSEBUS_STX) return;        /* None found yet.          */
+        if(rx_queued >= SER_RX_FRAMES) return;  /* Nowhere to put it.       */
+        rx_crc = crc_rev_init;                  /* STX is not in the CRC.   */
+    } else if(index <= GSEBUS_IDX_LEN || index <= buf[GSEBUS_IDX_LEN]){
+        rx_crc = crc_rev_step(rx_crc, rxChar);  /* Header, payload and CRC. */
     }
-    rtc_tickDelay(rtc_ser_timeout, SER_RX_CH_TIMEOUT);
-    rxtx_buf[index++] = rxChar;                 /* Record char.             */
+    ser_rx_timer_start(SER_RX_CH_TIMEOUT_CYCLES);
+    buf[index++] = rxChar;                      /* Record char.             */
     rx_index = index;                           /* Update buf write index   */
+
+    if(index > GSEBUS_IDX_LEN){                 /* Packet length valid?     */
+        uint8_t len = buf[GSEBUS_IDX_LEN];
+        if(index > len + 1){                    /* Complete packet?         */
+            rx_index = 0;                       /* Ready for next packet.   */
+            TBCCTL3 = 0;                        /* Nothing to time out.     */
+            if(buf[GSEBUS_IDX_TADR] != GSEBUS_ADDR_ID_WTS ||
+               len <= GSEBUS_IDX_PAYLOAD){
+                return;         /* Packet not for us, or framing bad. */
+            }
+            if(buf[len + 1] != GSEBUS_ETX){
+                return;         /* Packet not for us, or framing bad. */
+            }
+            rx_frame_crc[rx_head] = rx_crc;     /* Zero if CRC matched.     */
+            rx_head ^= 1;                       /* Queue it for comms_poll. */
+            rx_queued++;
+        }
+    }
 }
 
 /******************************************************************************/
@@ -455,12 +862,22 @@ __interrupt void ser_txIsr(void);   /* Prototype */
 __interrupt void ser_txIsr(void)
 #endif
 {
-    uint8_t tmp;
+    uint8_t tmp, ch;
     tmp = tx_index++;
-    TXBUF0 = rxtx_buf[tmp++];
+    ch = tx_buf[tmp++];
+    TXBUF0 = ch;
+
+    if(tmp > 1 && tmp <= tx_crc_end){   /* Header or payload, (not STX)? */
+        uint16_t crc = crc_rev_step(tx_crc, ch);
+        tx_crc = crc;
+        if(tmp == tx_crc_end){          /* Last one, append the CRC.    */
+            tx_buf[tmp]     = crc;      /* Low byte.    */
+            tx_buf[tmp + 1] = crc >> 8; /* High byte.   */
+        }
+    }
 
     if(tmp >= tx_size){             /* Whole message sent?      */
-        rtc_tickDelay(rtc_ser_timeout, SER_TX_HOLDTIME);
+        ser_tx_timer_start(ser_cycles.drain);
         IE1 &= ~(UTXIE0);           /* Disable this interrupt.  */
     }
 }
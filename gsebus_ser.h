@@ -28,6 +28,16 @@ gsebus_header_t * gsebus_rx_pkt(void);
 
 void gsebus_tx_nack(void);
 
+void ser_state_machine(void);
+uint8_t ser_rx_can_stall(uint32_t cycles);
+
+uint8_t ser_baud_request(uint8_t code);
+uint8_t ser_baud_get(void);
+
+/*-- Turnaround timer expiry, from the Timer B interrupt. */
+void ser_tx_tirq(void);
+void ser_rx_tirq(void);
+
 /*-- Response construction functions.   */
 void gsebus_formtx_nack(void);
 void gsebus_formtx_ack (void);
@@ -38,4 +48,8 @@ void gsebus_formtx_add_zero_fill(uint8_t sz);
 void gsebus_formtx_add_mem(void *src, uint8_t sz);
 void gsebus_formtx_finalise(void);
 
+/*-- Batched responses, one item per location.  */
+uint8_t gsebus_formtx_item_start(void);
+uint8_t gsebus_formtx_item_end(void);
+
 #endif      /* #ifndef GSEBUS_SER_H */
@@ -51,6 +51,8 @@ void main(void)
         /* sleep()? */
         rtc_state_machine();        /* Keep timers up to date.  */
         comms_poll();               /* Process comms messages.  */
+        fls_state_machine();        /* Background firmware writes.  */
+        reflash_state_machine();    /* Background code flash checks.*/
         anin_state_machine();       /* Filter analogue inputs.  */
         fail_safe_state_machine();
     }
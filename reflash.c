@@ -23,18 +23,31 @@
  *      together to provide a binary image "WaterTreatmentSystem.fwi" with
  *      CRC inserted.
  *
+ *      Why copy rather than run whichever half holds the newest image (A/B
+ *      banks, with a boot stub owning the vectors)?  Both halves are the
+ *      one link for 0xE000 (-U in the linker file), so the code can only
+ *      run there.  A/B would need each image linked for each bank and the
+ *      CCP to send the one for the idle bank, a stub in a segment no
+ *      reflash touches, (not 0xFE00, the vectors move with every image
+ *      now), and a way over for boards whose old code calls into
+ *      0xC000.  Meanwhile only the segments that changed are rewritten,
+ *      a row at a time, and the boot records tell start up the result.
+ *
  *  COPYRIGHT:  Ceramic Fuel Cells Limited 2009
  *
  ******************************************************************************
  */
 #include <io430.h>
 #include <in430.h>
+#include <string.h>
 
 #include "crc_api.h"
+#include "fls_api.h"
 #include "wdg.h"
 #include "reflash.h"
 #include "wts_comms.h"
 #include "pio.h"
+#include "gsebus_ser.h"
 
 #define ORIGIN          (0xC000)
 #define DESTINATION     (0xE000)
@@ -42,7 +55,107 @@
 
 #define FLASH_SEG_SZ    (512)
 
-void do_save_flash(void);
+#if LENGTH / FLASH_SEG_SZ != WTS_FW_SEGS || FLASH_SEG_SZ != WTS_FW_SEG_SIZE ||\
+    ORIGIN != WTS_FW_NEW_COPY
+#error Code copy layout does not match WTS_DADR_FW_SEG_CRC
+#endif
+
+/*-- Segments the last reflash rewrote, set by the reflash and kept over */
+/*   the reset that follows, REFLASH_DONE in the top byte if so.        */
+#define REFLASH_DONE    (0xA500)
+__no_init uint16_t reflash_result;
+static uint8_t reflash_segs = WTS_REFLASH_NONE;
+
+/*-- Boot records, in INFOB.  Each says the running code whose last     */
+/*   segment has CRC key passed its full CRC check, so later start ups  */
+/*   need only CRC that segment.  Appended, the segment being erased    */
+/*   once full, and by each reflash.  The image CRC cannot be the key,  */
+/*   it is forced to the reset vector, but the last segment holds the   */
+/*   bytes that force it, so differs between builds.                    */
+#define BOOT_REC_SEG    (0x1000)        /* INFOB.                       */
+#define BOOT_REC_SEG_SZ (128)
+#define BOOT_KEY_SEG    (LENGTH / FLASH_SEG_SZ - 1)
+
+struct boot_rec {
+    uint16_t key;                       /* CRC of last segment.         */
+    uint16_t crc;                       /* Of key.                      */
+};
+#define BOOT_RECS       (BOOT_REC_SEG_SZ / sizeof(struct boot_rec))
+/*-- The linker puts this label at BOOT_REC_SEG (-D in the .xcl), so the */
+/*   compiler sees a real array, not a cast constant address.  It is     */
+/*   flash, only written through fls_write.                              */
+extern struct boot_rec boot_recs[BOOT_RECS];
+
+/*-- Checks left to reflash_state_machine. */
+#define BOOT_BG_BYTES   (64)            /* CRC'd per call, ~80us.       */
+enum boot_bg_state {
+    BOOT_BG_MAIN,                       /* Full CRC of running code.    */
+    BOOT_BG_COPY,                       /* CRC of new copy.             */
+    BOOT_BG_ERASE,                      /* Rewrite new copy from main,  */
+    BOOT_BG_REPAIR,                     /* a segment at a time.         */
+    BOOT_BG_DONE
+};
+static struct {
+    uint8_t  state;                     /* enum boot_bg_state.          */
+    uint8_t  status;                    /* WTS_BOOT_xxx.                */
+    uint16_t off;                       /* Offset into the image.       */
+    uint16_t crc;                       /* Running CRC to off.          */
+} boot_bg;
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          boot_rec_free
+ *  FUNCTIONAL DESCRIPTION: Find the first free boot record slot, that after
+ *                          the newest record.
+ *  RETURN VALUE:           Slot, BOOT_RECS if none is free.
+ ******************************************************************************
+ */
+#pragma location="this_code_first"    /* Place near start of flash. */
+static uint8_t boot_rec_free(void)
+{
+    uint8_t n = BOOT_RECS;
+
+    while(n != 0 && boot_recs[n - 1].key == 0xFFFF &&
+          boot_recs[n - 1].crc == 0xFFFF){
+        n--;
+    }
+    return n;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          boot_rec_add
+ *  FUNCTIONAL DESCRIPTION: Record that the running code passed its full
+ *                          CRC check.
+ *  FORMAL PARAMETERS:      key : CRC of its last segment.
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           Erases INFOB if full, (~11ms).
+ ******************************************************************************
+ */
+#pragma location="this_code_first"    /* Place near start of flash. */
+static void boot_rec_add(uint16_t key)
+{
+    struct boot_rec rec;
+    uint8_t n = boot_rec_free();
+
+    if(n == BOOT_RECS){
+        fls_erase((const uint16_t *)BOOT_REC_SEG);
+        n = 0;
+    }
+    rec.key = key;
+    gsebus_crc_generate(&rec, sizeof(rec) - crc_overhead);
+    fls_write((const uint16_t *)&boot_recs[n], &rec,
+              sizeof(rec) / sizeof(uint16_t));
+}
+
+/*-- Drop the boot records, the running code is not what they say. */
+#pragma location="this_code_first"    /* Place near start of flash. */
+static void boot_rec_clear(void)
+{
+    if(boot_rec_free() != 0){
+        fls_erase((const uint16_t *)BOOT_REC_SEG);
+    }
+}
 
 /*
  ******************************************************************************
@@ -58,61 +171,161 @@ void do_save_flash(void);
 #pragma location="this_code_first"    /* Place near start of flash. */
 void reflash_startup_check(void)
 {
+    uint16_t key = gsebus_crc_calc(
+                       (void *)(DESTINATION + BOOT_KEY_SEG * FLASH_SEG_SZ),
+                       FLASH_SEG_SZ);
+    uint8_t n;
+
+    /*-- Have we just been reflashed? */
+    if((reflash_result & 0xFF00) == REFLASH_DONE){
+        reflash_segs = (uint8_t)reflash_result;
+    }
+    reflash_result = 0;
+
+    /*-- Same code as last checked?  Not after a flash key or access   */
+    /*   violation though, (must look before anything writes FCTL3).  */
+    n = boot_rec_free();
+    if(!(FCTL3 & (KEYV | ACCVIFG)) && n != 0 &&
+       boot_recs[n - 1].key == key &&
+       !gsebus_crc_isInvalid((void *)&boot_recs[n - 1],
+                             sizeof(struct boot_rec) - crc_overhead)){
+        /*-- Yes, leave the full check to reflash_state_machine. */
+        boot_bg.status = WTS_BOOT_CACHED;
+        boot_bg.state  = BOOT_BG_MAIN;
+        boot_bg.crc    = crc_rev_init;
+        return;
+    }
+
     if(gsebus_crc_isInvalid((void*)DESTINATION, LENGTH - 2)){
         /*-- There is a CRC error in the main flash, try the copy.  */
-        do_reflash();
+        /*   All of it, a segment left half erased may still read OK. */
+        do_reflash(REFLASH_ALL);
         /*-- We come here if there is a CRC error in the copy too.
         *   best option is just to carry on and hope it works.
         */
+        boot_rec_clear();
         flash_err = 1;
-    } else if(gsebus_crc_isInvalid((void*)ORIGIN, LENGTH - 2)){
-        /*-- Second copy has error.  Overwrite this with the main copy. */
-        do_save_flash();
+        boot_bg.state = BOOT_BG_DONE;
+    } else {
+        boot_rec_add(key);
+        /*-- Check the second copy in the background. */
+        boot_bg.status = WTS_BOOT_MAIN_OK;
+        boot_bg.state  = BOOT_BG_COPY;
+        boot_bg.crc    = crc_rev_init;
     }
 }
 
 /*
  ******************************************************************************
- *  FUNCTION NAME:          do_save_flash();
- *  FUNCTIONAL DESCRIPTION: Make a complete copy of the primary flash over
- *                          the secondary flash.
- *                          Performed if there is an error detected in the
- *                          backup image.
+ *  FUNCTION NAME:          reflash_bg_crc
+ *  FUNCTIONAL DESCRIPTION: Carry the CRC of an image on over the next
+ *                          BOOT_BG_BYTES of it.
+ *  FORMAL PARAMETERS:      base    : ORIGIN or DESTINATION.
+ *  RETURN VALUE:           NZ once the whole image, (CRC bytes and all),
+ *                          is done, boot_bg.crc then being Z if it is OK.
+ ******************************************************************************
+ */
+static uint8_t reflash_bg_crc(uint16_t base)
+{
+    const uint8_t *p = (const uint8_t *)(base + boot_bg.off);
+    uint16_t crc = boot_bg.crc;
+    uint8_t n = BOOT_BG_BYTES;
+
+    do {
+        crc = crc_rev_step(crc, *p++);
+    } while(--n);
+    boot_bg.crc  = crc;
+    boot_bg.off += BOOT_BG_BYTES;
+    return boot_bg.off == LENGTH;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          reflash_state_machine
+ *  FUNCTIONAL DESCRIPTION: The code flash checks reflash_startup_check
+ *                          leaves until the system is running.  The full
+ *                          CRC of the running code if a boot record let
+ *                          start up skip it, then the CRC of the new copy,
+ *                          rewriting that from the running code if bad.
+ *                          Call from main loop.
  *  FORMAL PARAMETERS:      None
  *  RETURN VALUE:           None
- *  SIDE EFFECTS:           None 
- *  Notes:                  Run this with interrupts turned off,
- *                          and watchdog disabled.
+ *  SIDE EFFECTS:           Bad running code is reflashed from the new copy
+ *                          as start up would have, (so does not return).
+ *  Notes:                  The new copy is left alone once a download has
+ *                          started, as that is rewriting it.
  ******************************************************************************
  */
-void do_save_flash(void)
+void reflash_state_machine(void)
 {
-    uint16_t *source_addr = (uint16_t *)DESTINATION;
-    uint16_t *dest_addr   = (uint16_t *)ORIGIN;
-    
-    int16_t seg_count    = LENGTH / FLASH_SEG_SZ;
-     
-    /* Unlock flash writes. */
-    FCTL3 = FWKEY;  /* Unlock */
-    
-    do {
-        int16_t word_count;
-        /* Flash Error LED fast during this process. */
-        P3DIR ^= P3O7_N_LED_ALARM;
-        
-        /* Clear the segment.   */
-        FCTL1 = FWKEY | ERASE;
-        *dest_addr = 0;             /* Trigger the erase.   */
-        while (FCTL3 & BUSY);       /* Wait for completion. */
-        
-        word_count = FLASH_SEG_SZ / sizeof(uint16_t);
-        FCTL1 = FWKEY | WRT;                   
-        do {
-            *dest_addr++ = *source_addr++;
-            while (FCTL3 & BUSY);       /* Wait for completion. */
-        }while(--word_count);
-    }while (--seg_count);
-    FCTL3 = FWKEY | LOCK;
+    switch(boot_bg.state){
+        case BOOT_BG_MAIN:
+            if(reflash_bg_crc(DESTINATION)){
+                if(boot_bg.crc != 0){
+                    boot_rec_clear();   /* Record was wrong.            */
+                    do_reflash(REFLASH_ALL);
+                    flash_err = 1;      /* Copy bad too.                */
+                    boot_bg.state = BOOT_BG_DONE;
+                    break;
+                }
+                boot_bg.status |= WTS_BOOT_MAIN_OK;
+                boot_bg.state = BOOT_BG_COPY;
+                boot_bg.off   = 0;
+                boot_bg.crc   = crc_rev_init;
+            }
+            break;
+        case BOOT_BG_COPY:
+            if(fls_fwug_started()){
+                boot_bg.state = BOOT_BG_DONE;
+            } else if(reflash_bg_crc(ORIGIN)){
+                boot_bg.off = 0;
+                if(boot_bg.crc == 0){
+                    boot_bg.status |= WTS_BOOT_COPY_OK;
+                    boot_bg.state = BOOT_BG_DONE;
+                } else if(boot_bg.status & WTS_BOOT_COPY_FIXED){
+                    boot_bg.state = BOOT_BG_DONE;   /* Will not write.  */
+                } else {
+                    boot_bg.state = BOOT_BG_ERASE;
+                }
+            }
+            break;
+        case BOOT_BG_ERASE:
+            /*-- Erase stalls the CPU ~11ms, so only with no packet in. */
+            /*   A packet starting during it is lost, the CCP retries.   */
+            if(fls_fwug_started()){
+                boot_bg.state = BOOT_BG_DONE;
+            } else if(ser_rx_can_stall(FLS_ERASE_CYCLES)){
+                fls_erase((const uint16_t *)(ORIGIN + boot_bg.off));
+                boot_bg.state = BOOT_BG_REPAIR;
+            }
+            break;
+        case BOOT_BG_REPAIR:
+            if(fls_fwug_started()){
+                boot_bg.state = BOOT_BG_DONE;
+            } else if(ser_rx_can_stall(FLS_BLK_CYCLES(1))){
+                uint8_t words[FLS_BG_WORDS * 2];
+                uint8_t n = FLS_BG_WORDS;
+
+                if(n > (LENGTH - boot_bg.off) / 2){
+                    n = (LENGTH - boot_bg.off) / 2;
+                }
+                memcpy(words, (const void *)(DESTINATION + boot_bg.off), n * 2);
+                boot_bg.off += 2 * fls_write_block(
+                    (const uint16_t *)(ORIGIN + boot_bg.off), words, n);
+                if(boot_bg.off == LENGTH){
+                    /*-- Check it took. */
+                    boot_bg.status |= WTS_BOOT_COPY_FIXED;
+                    boot_bg.state = BOOT_BG_COPY;
+                    boot_bg.off   = 0;
+                    boot_bg.crc   = crc_rev_init;
+                } else if(boot_bg.off % FLASH_SEG_SZ == 0){
+                    boot_bg.state = BOOT_BG_ERASE;
+                }
+            }
+            break;
+        default:
+            break;
+    }
 }
 
 /*
@@ -121,20 +334,29 @@ void do_save_flash(void)
  *  FUNCTIONAL DESCRIPTION: re-flash the flash.  Copy the flash content from
  *                          the download location to the execution location.
  *                          This is the scary bit in the whole process.
- *  FORMAL PARAMETERS:      None
+ *                          Segments that are the same already are left
+ *                          alone, unless mode is REFLASH_ALL.
+ *  FORMAL PARAMETERS:      mode    : REFLASH_CHANGED or REFLASH_ALL.
  *  RETURN VALUE:           None
- *  SIDE EFFECTS:           None 
+ *  SIDE EFFECTS:           Number of segments rewritten left in
+ *                          reflash_result for after the reset.
+ *                          Boot records erased first, so a reflash cut
+ *                          short is CRC checked in full at start up.
  *  Note:                   This codes run from the download location.
  *                          Don't use any function calls.
  *                          Check the assembly listing produced to make sure
  *                          there are no glue function calls added.
+ *                          It is called by the old code's do_reflash, which
+ *                          may pass no mode at all, hence REFLASH_ALL being
+ *                          a magic number.
  ******************************************************************************
  */
 #pragma location="start_of_origin"
-static void do_reflash_executed_from_within_copy(void)
+static void do_reflash_executed_from_within_copy(uint16_t mode)
 {
     uint16_t *source_addr = (uint16_t *)ORIGIN;
     uint16_t *dest_addr   = (uint16_t *)DESTINATION;
+    uint8_t rewritten = 0;
     
     __disable_interrupt();
     
@@ -143,8 +365,27 @@ static void do_reflash_executed_from_within_copy(void)
     /* Unlock flash writes. */
     FCTL3 = FWKEY;  /* Unlock */
     
+    /* Drop the boot records.   */
+    FCTL1 = FWKEY | ERASE;
+    *(uint16_t *)BOOT_REC_SEG = 0;
+    
     while(dest_addr != NULL){   /* 0 is just after the last vector. */
-        uint16_t wr_counter;
+        uint16_t wr_counter = FLASH_SEG_SZ/sizeof(uint16_t);
+        
+        /* Same already?    */
+        if(mode != REFLASH_ALL){
+            uint16_t *s = source_addr;
+            uint16_t *d = dest_addr;
+            while(wr_counter != 0 && *s++ == *d++){
+                wr_counter--;
+            }
+            if(wr_counter == 0){
+                source_addr += FLASH_SEG_SZ/sizeof(uint16_t);
+                dest_addr   += FLASH_SEG_SZ/sizeof(uint16_t);
+                continue;
+            }
+        }
+        rewritten++;
         
         /* Clear the segment.   */      
         while (FCTL3 & BUSY);
@@ -166,18 +407,42 @@ static void do_reflash_executed_from_within_copy(void)
         }while(--wr_counter);
     }
     FCTL3 = FWKEY | LOCK;
+    reflash_result = REFLASH_DONE | rewritten;
     /* Pheuph!  Have re-flashed.  Lets just hope it runs now. */
     WDTCTL = WDT_MRST_0_064;
     while(1);   /* Only 64mS to wait for the Grim Reaper. */
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          reflash_seg_crc
+ *  FUNCTIONAL DESCRIPTION: CRC of one flash segment of either copy of the
+ *                          code, so the CCP can tell which segments of a
+ *                          new image it need send.
+ *  FORMAL PARAMETERS:      staging : NZ for the new copy (ORIGIN), Z for
+ *                                    the running one (DESTINATION).
+ *                          seg     : Segment, 0 to WTS_FW_SEGS - 1.
+ *  RETURN VALUE:           CRC, as gsebus_crc_calc.
+ *  SIDE EFFECTS:           None 
+ *  Notes:                  ~40ms for all segments of both copies.
+ ******************************************************************************
+ */
+uint16_t reflash_seg_crc(uint8_t staging, uint8_t seg)
+{
+    uint16_t base = staging? ORIGIN: DESTINATION;
+
+    return gsebus_crc_calc((void *)(base + seg * FLASH_SEG_SZ), FLASH_SEG_SZ);
+}
+
 /*
  ******************************************************************************
  *  FUNCTION NAME:          do_reflash
  *  FUNCTIONAL DESCRIPTION: Check the CRC of the new copy of the code, if OK
  *                          call the re-flash routine at the start of that
  *                          new code.
- *  FORMAL PARAMETERS:      None
+ *  FORMAL PARAMETERS:      mode    : REFLASH_CHANGED to rewrite only the
+ *                                    segments that differ, REFLASH_ALL
+ *                                    for the lot.
  *  RETURN VALUE:           None
  *  SIDE EFFECTS:           None 
  *  Notes:                  The CRC must be the reset vector.  The actual
@@ -190,7 +455,7 @@ static void do_reflash_executed_from_within_copy(void)
  ******************************************************************************
  */
 #pragma location="this_code_first"    /* Early execution code. */
-uint8_t do_reflash(void)
+uint8_t do_reflash(uint16_t mode)
 {
     if(gsebus_crc_isInvalid((void*)ORIGIN, LENGTH - 2)){
         /* Refuse to re-flash if copy not valid.    */
@@ -199,6 +464,32 @@ uint8_t do_reflash(void)
     
     /*-- Call the function running WITHIN the memory space of the new flash
     *   copy. */
-    do_reflash_executed_from_within_copy();     /* Never returns.           */
+    do_reflash_executed_from_within_copy(mode); /* Never returns.           */
     return 0;   /* Never realy returns. */
 }
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          reflash_last_segs
+ *  FUNCTIONAL DESCRIPTION: Segments rewritten by the reflash just before
+ *                          the last reset.
+ *  RETURN VALUE:           Count, WTS_REFLASH_NONE if there was none.
+ ******************************************************************************
+ */
+uint8_t reflash_last_segs(void)
+{
+    return reflash_segs;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          reflash_boot_status
+ *  FUNCTIONAL DESCRIPTION: How the code flash has been checked since start
+ *                          up, see reflash_state_machine.
+ *  RETURN VALUE:           WTS_BOOT_xxx flags.
+ ******************************************************************************
+ */
+uint8_t reflash_boot_status(void)
+{
+    return boot_bg.status | (boot_bg.state == BOOT_BG_DONE? WTS_BOOT_DONE: 0);
+}
@@ -18,7 +18,15 @@
 #define REFLASH_H
 #include "cfcl.h"
 
+/*-- do_reflash modes. */
+#define REFLASH_CHANGED (0)         /* Only segments that differ.       */
+#define REFLASH_ALL     (0xA11C)    /* Every segment.                   */
+
 void reflash_startup_check(void);
-uint8_t do_reflash(void);
+void reflash_state_machine(void);
+uint8_t reflash_boot_status(void);
+uint8_t do_reflash(uint16_t mode);
+uint8_t reflash_last_segs(void);
+uint16_t reflash_seg_crc(uint8_t staging, uint8_t seg);
 
 #endif /* #ifndef REFLASH_H */
@@ -31,8 +31,8 @@ typedef enum {
     //rtc_pid_check,   /* check the pid flash constants every minute          */
     //rtc_pid_pause,   /* recalc the PID algo every 98ms                      */
     //rtc_pwm_check,   /* check the pwm flash constants every minute          */
-    rtc_ser_timeout, /* when no char received after 16ms reset the receiver */
     rtc_ser_led,     /* Status LED timer.                                   */
+    rtc_ser_baud,    /* Time allowed to confirm a baud rate change.         */
     //rtc_tcs_pause,   /* let analogue to stablise or wait for a sample       */
     //rtc_tcs_recal,   /* perform a self calibration every minute             */
     //rtc_pul_deb0,    /* Debounce for pulse counter                          */
@@ -24,7 +24,6 @@
 #include "stdint.h"
 
 void  ser_init(void);
-void  ser_state_machine(void);
 void  ser_start_transmission(void);
 
 #endif /* __SER_API_H__ */
@@ -20,21 +20,24 @@
 #include "pio.h"
 #include "steam_flow.h"     /* Rate to step steam flow stepper. */
 #include "cooling_air_valve.h"
-#include "anin.h"
 #include "solenoids.h"
+#include "gsebus_ser.h"    /* Serial line turnaround timers. */
 
 volatile uint8_t systick;       /* Incremented once every 8.192ms in TIMERA */
+#ifdef TIMER_LAT_ENABLE
+volatile uint16_t timer_latency_max[TIMER_LAT_CHANNELS];
+#endif
 
 #pragma location="this_code_first"    /* Place near start of flash. */
 void timerA_init(void)
 {
     TACCR0 = 0;                             // Set TACCR0 count offset
-    TACCR1 = CONDUCTIVITY_METER_IRQ_PERIOD; // Set TACCR1 count offset
     TACCR2 = SOLENOID_IRQ_PERIOD;           // For modulation of solenoid outs
     TACCTL0 &= ~CAP;                        // Set Timer Control Register to 
                                             // compare mode 
     TACCTL0  = CCIE;                        // Compare mode, irq enabled.
-    TACCTL1  = CCIE;                        // Timer in compare mode, interrupt
+    TACCTL1  = OUTMOD_0;                    // OUT1 low, the ADC trigger,
+                                            // started by anin_init.
     TACCTL2  = CCIE;
 
     TACTL = MC_2 |                          // Continuous up mode.
@@ -46,6 +49,8 @@ void timerA_init(void)
 /*--- Timer B used for PWM generation, not currently used. */
 /*    For PWM generation we are fixing at 12 bit.  This gives us an 
  *    output frequency of approx 2kHz. (8MHz / 2^12 = 1953.125)
+ *    Compares 2 and 3 are one shot serial turnaround timers, they are
+ *    set up by gsebus_ser.c.
  */
 #pragma location="this_code_first"    /* Place near start of flash. */
 void timerB_init(void)
@@ -99,6 +104,25 @@ void pwm2_set(uint16_t level){
     TBCCR5 = level;
 }
 
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          timer_latency_clear
+ *  FUNCTIONAL DESCRIPTION: Start a new worst case ISR latency measurement.
+ *  FORMAL PARAMETERS:      None
+ *  RETURN VALUE:           None
+ *  SIDE EFFECTS:           None 
+ ******************************************************************************
+ */
+#ifdef TIMER_LAT_ENABLE
+void timer_latency_clear(void)
+{
+    uint8_t i;
+    for(i = 0; i < TIMER_LAT_CHANNELS; i++){
+        timer_latency_max[i] = 0;       /* (Word writes are atomic.)    */
+    }
+}
+#endif
+
 #pragma vector=TIMERA0_VECTOR   /* CCR0 Interrupt vector. */
 #pragma location="this_code_first"    /* Place near start of flash. */
 /*--- Used to control the steam flow rate stepper motor. */
@@ -106,6 +130,7 @@ void pwm2_set(uint16_t level){
 static __interrupt void TIMER0_interupt_handler(void)
 {
     static uint8_t cycles;
+    TIMER_LAT(TIMER_LAT_CCR0, TACCR0);
     /*--- Step water flow pump if required. */
     if(steam_flow.enabled){                 /* Should be delivering steam?  */
         if(cycles != 0){                    /* Still whole 8mS cycle to go? */
@@ -125,12 +150,8 @@ static __interrupt void TIMER0_interupt_handler(void)
 static __interrupt void TIMER1_interupt_handler(void)
 {
     switch(__even_in_range(TAIV, 10)){  /* MSP430 Wacky interrupt vector.   */
-        case TAIV_CCIFG1:               /* Capture/compare 1                */
-            TACCR1 += CONDUCTIVITY_METER_IRQ_PERIOD;
-            anin_tirq();                /* Synchronous ADC sampling.        */
-            break;
-
         case TAIV_CCIFG2:               /* Capture/compare 2.               */
+            TIMER_LAT(TIMER_LAT_CCR2, TACCR2);
             TACCR2 += SOLENOID_IRQ_PERIOD;  /* Schedule next interrupt. */
 
             /* Switch on or PWM modulate solenoid outputs. */
@@ -210,4 +231,13 @@ static __interrupt void timerB0_interupt_handler( void )
 #pragma vector = TIMERB1_VECTOR
 static __interrupt void timerB1_interupt_handler( void )
 {
+    switch(__even_in_range(TBIV, 14)){  /* Reading TBIV clears the CCIFG. */
+        case TBIV_TBCCR2:               /* Serial Rx -> Tx turnaround.    */
+            ser_tx_tirq();
+            break;
+
+        case TBIV_TBCCR3:               /* Serial Rx inter char timeout.  */
+            ser_rx_tirq();
+            break;
+    }
 }
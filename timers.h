@@ -21,3 +21,29 @@ void timerA_init(void);
 void timerB_init(void);
 void pwm1_set(uint16_t level);
 void pwm2_set(uint16_t level);
+
+/*-- Worst case interrupt latency, compare match to ISR, in SMCLK cycles. */
+/*   Only kept when TIMER_LAT_ENABLE is defined (the Debug configuration), */
+/*   so release ISRs do not pay for it.                                    */
+#ifdef TIMER_LAT_ENABLE
+#define TIMER_LAT_CCR0      0       /* Steam stepper.       */
+#define TIMER_LAT_CCR1      1       /* ADC sequence, (CCR1 starts it, the */
+                                    /* ADC interrupt ends it, so this     */
+                                    /* includes the ~2550 cycles of the   */
+                                    /* conversions).                      */
+#define TIMER_LAT_CCR2      2       /* Solenoid PWM.        */
+#define TIMER_LAT_CHANNELS  3
+extern volatile uint16_t timer_latency_max[TIMER_LAT_CHANNELS];
+
+/*-- Note how long after its compare match an ISR got going.  TAR keeps   */
+/*   counting, so (TAR - TACCRn) is the latency, while TACCRn is unchanged.*/
+#define TIMER_LAT(chnl, ccr) do{                        \
+        uint16_t lat_ = TAR - (ccr);                     \
+        if(lat_ > timer_latency_max[chnl]){              \
+            timer_latency_max[chnl] = lat_;              \
+        }                                                \
+    }while(0)
+void timer_latency_clear(void);
+#else
+#define TIMER_LAT(chnl, ccr)
+#endif
@@ -0,0 +1,247 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    anin_bench.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Compares the anin.c filters with the 256 reading boxcar
+ *              averages they replaced, for step response and noise.
+ *
+ *              Drives anin_tirq straight, (no timers), with ADC readings
+ *              made up here, and runs a copy of the old boxcar alongside
+ *              on the same readings.  For a fast channel (probe 1
+ *              temperature), a probe (probe 1 conductivity) and a
+ *              multiplexed input (fill solenoid current) it gives:
+ *                  step    Time from a step in to 90% of it out, mean
+ *                          and worst over where the step falls.
+ *                  noise   RMS of the output about the mean for a steady
+ *                          input with noise added to each reading.
+ *                  pickup  RMS of the output about the input for a
+ *                          steady input with BENCH_PICKUP_50HZ of mains
+ *                          and BENCH_PICKUP_DRIFT of slow drift added.
+ *
+ *              The probe reads BENCH_PROBE_OFF while not excited, and
+ *              that plus the input while excited.  The boxcar only read
+ *              it excited, so BENCH_PROBE_OFF is taken off its output, as
+ *              calibration would.
+ *
+ *              Usage: anin_bench [noise rms, ADC counts (default 20)]
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "io430.h"
+#include "sim.h"
+
+#include "anin.h"
+#include "pio.h"
+#include "wts_comms.h"
+
+#define BENCH_TICK_MS       (1000.0 / CONDUCTIVITY_METER_IRQ_FREQUENCY)
+#define BENCH_SETTLE        (16384)     /* Ticks before each step.        */
+#define BENCH_PHASES        (64)        /* Step positions tried.          */
+#define BENCH_LOW           (1000)
+#define BENCH_HIGH          (3000)
+#define BENCH_STEADY        (2000)
+#define BENCH_NOISE_TICKS   (400000)
+#define BENCH_PROBE_OFF     (200)       /* Probe reading not excited.     */
+#define BENCH_PICKUP_50HZ   (20.0)      /* Pickup, peak ADC counts.       */
+#define BENCH_PICKUP_DRIFT  (50.0)      /* (At 0.1Hz.)                    */
+
+/*-- Channels looked at. */
+enum { CH_FAST, CH_PROBE, CH_MUX, CH_N };
+static const char *const ch_name[CH_N] = {
+    "probe 1 temperature", "probe 1 conductivity", "fill current"
+};
+
+/*-- The old boxcar, 256 readings then publish. */
+struct boxcar {
+    uint32_t acum;
+    uint16_t av;
+};
+
+static struct boxcar box[CH_N];
+static uint16_t ticks;                  /* As anin.c sequence_counter.    */
+
+/*-- Is the reading for channel ch taken this tick, (sc before the inc). */
+static int box_reads(int ch, uint16_t sc)
+{
+    switch(ch){
+        case CH_FAST:   return 1;
+        case CH_PROBE:  return (sc & 3) == 2;
+        default:        return sc % 8 == AMUX_FILL_CURRENT;
+    }
+}
+
+/*-- Gaussian noise, (Box Muller). */
+static double gauss(void)
+{
+    double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/*-- One ADC reading of level x, with noise and pickup. */
+static uint16_t bench_read(double x, double rms, double pickup)
+{
+    x += pickup + rms * gauss();
+    return (x < 0)? 0: (x > 4095)? 4095: (uint16_t)(x + 0.5);
+}
+
+/*-- One timer tick: the same readings to both. */
+static void bench_tick(const uint16_t *in, double rms, double pickup,
+                       uint16_t *now, uint16_t *old)
+{
+    static const uint16_t publish[CH_N] = {256, 1024, 2048};
+    struct comms_wts_status st;
+    uint16_t sc = ticks;
+    double probe = BENCH_PROBE_OFF;
+    uint16_t rd[CH_N];
+    int ch;
+
+    if(P4OUT & P4O6_PROBE_SAMPLE){
+        probe += in[CH_PROBE];
+    }
+    rd[CH_FAST]  = bench_read(in[CH_FAST], rms, pickup);
+    rd[CH_PROBE] = bench_read(probe, rms, pickup);
+    rd[CH_MUX]   = bench_read(in[CH_MUX], rms, pickup);
+    sim_adc12mem[ADC_PROBE1_TEMP] = rd[CH_FAST];
+    sim_adc12mem[ADC_PROBE1]      = rd[CH_PROBE];
+    sim_adc12mem[ADC_PROBE1_B]    = bench_read(probe, rms, pickup);
+    sim_adc12mem[ADC_MUX]         = (sc % 8 == AMUX_FILL_CURRENT)?
+                                    rd[CH_MUX]: 0;
+    anin_tirq();
+
+    for(ch = 0; ch < CH_N; ch++){
+        if(box_reads(ch, sc)){
+            box[ch].acum += rd[ch];
+        }
+    }
+    ticks = ++sc;
+    for(ch = 0; ch < CH_N; ch++){
+        if(sc % publish[ch] == 0){
+            box[ch].av   = box[ch].acum / 256;
+            box[ch].acum = 0;
+        }
+        old[ch] = box[ch].av;
+    }
+    old[CH_PROBE] -= (old[CH_PROBE] >= BENCH_PROBE_OFF)? BENCH_PROBE_OFF:
+                                                         old[CH_PROBE];
+
+    anin_rd_to_comms(&st);
+    now[CH_FAST]  = st.anin_probe1_temperature;
+    now[CH_PROBE] = st.anin_probe1_conductivity;
+    now[CH_MUX]   = st.anin_fill_current;
+}
+
+int main(int argc, char *argv[])
+{
+    double rms_in = (argc > 1)? atof(argv[1]): 20.0;
+    uint16_t in[CH_N], now[CH_N], old[CH_N];
+    double sum_new[CH_N] = {0}, sum_old[CH_N] = {0};
+    double max_new[CH_N] = {0}, max_old[CH_N] = {0};
+    double s1n[CH_N] = {0}, s2n[CH_N] = {0}, s1o[CH_N] = {0}, s2o[CH_N] = {0};
+    double pn[CH_N] = {0}, po[CH_N] = {0};
+    const uint16_t level = BENCH_LOW + (BENCH_HIGH - BENCH_LOW) * 9 / 10;
+    unsigned long t;
+    int p, ch;
+
+    sim_init();                         /* (Time never moves on.)       */
+
+    /*-- Step response, noise free, the step at a different place in the */
+    /*   publishing cycles each time.                                    */
+    for(p = 0; p < BENCH_PHASES; p++){
+        int done_new[CH_N] = {0}, done_old[CH_N] = {0};
+        unsigned long settle = BENCH_SETTLE + p * 2048 / BENCH_PHASES;
+
+        for(ch = 0; ch < CH_N; ch++){
+            in[ch] = BENCH_LOW;
+        }
+        for(t = 0; t < settle; t++){
+            bench_tick(in, 0, 0, now, old);
+        }
+        for(ch = 0; ch < CH_N; ch++){
+            in[ch] = BENCH_HIGH;
+        }
+        for(t = 1; t <= BENCH_SETTLE; t++){
+            bench_tick(in, 0, 0, now, old);
+            for(ch = 0; ch < CH_N; ch++){
+                if(!done_new[ch] && now[ch] >= level){
+                    done_new[ch] = 1;
+                    sum_new[ch] += t;
+                    max_new[ch] = (t > max_new[ch])? t: max_new[ch];
+                }
+                if(!done_old[ch] && old[ch] >= level){
+                    done_old[ch] = 1;
+                    sum_old[ch] += t;
+                    max_old[ch] = (t > max_old[ch])? t: max_old[ch];
+                }
+            }
+        }
+    }
+
+    /*-- Noise, a steady input. */
+    for(ch = 0; ch < CH_N; ch++){
+        in[ch] = BENCH_STEADY;
+    }
+    for(t = 0; t < BENCH_SETTLE + BENCH_NOISE_TICKS; t++){
+        bench_tick(in, rms_in, 0, now, old);
+        if(t < BENCH_SETTLE){
+            continue;
+        }
+        for(ch = 0; ch < CH_N; ch++){
+            s1n[ch] += now[ch];
+            s2n[ch] += (double)now[ch] * now[ch];
+            s1o[ch] += old[ch];
+            s2o[ch] += (double)old[ch] * old[ch];
+        }
+    }
+
+    /*-- Pickup, a steady input. */
+    for(t = 0; t < BENCH_SETTLE + BENCH_NOISE_TICKS; t++){
+        double s = (double)t / CONDUCTIVITY_METER_IRQ_FREQUENCY;
+
+        bench_tick(in, 0, BENCH_PICKUP_50HZ * sin(2.0 * M_PI * 50.0 * s) +
+                          BENCH_PICKUP_DRIFT * sin(2.0 * M_PI * 0.1 * s),
+                   now, old);
+        if(t < BENCH_SETTLE){
+            continue;
+        }
+        for(ch = 0; ch < CH_N; ch++){
+            pn[ch] += ((double)now[ch] - BENCH_STEADY) *
+                      ((double)now[ch] - BENCH_STEADY);
+            po[ch] += ((double)old[ch] - BENCH_STEADY) *
+                      ((double)old[ch] - BENCH_STEADY);
+        }
+    }
+
+    printf("anin_bench: step %d to %d, to 90%%, and noise for %.1f rms in\n",
+           BENCH_LOW, BENCH_HIGH, rms_in);
+    printf("                          step mean / worst (ms)    "
+           "noise rms (counts)  pickup rms\n");
+    printf("  channel                 filter      boxcar        "
+           "filter  boxcar      filter  boxcar\n");
+    for(ch = 0; ch < CH_N; ch++){
+        double n = BENCH_NOISE_TICKS;
+        double var_new = s2n[ch] / n - (s1n[ch] / n) * (s1n[ch] / n);
+        double var_old = s2o[ch] / n - (s1o[ch] / n) * (s1o[ch] / n);
+
+        printf("  %-22s %5.0f / %-5.0f %5.0f / %-5.0f  %6.2f  %6.2f"
+               "      %6.2f  %6.2f\n",
+               ch_name[ch],
+               sum_new[ch] / BENCH_PHASES * BENCH_TICK_MS,
+               max_new[ch] * BENCH_TICK_MS,
+               sum_old[ch] / BENCH_PHASES * BENCH_TICK_MS,
+               max_old[ch] * BENCH_TICK_MS,
+               sqrt(var_new > 0? var_new: 0), sqrt(var_old > 0? var_old: 0),
+               sqrt(pn[ch] / n), sqrt(po[ch] / n));
+    }
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    ccp_bench.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: CCP stand in, for measuring GSEBUS transaction rates.
+ *              Polls the WTS with WR, RD and WR_RD_DATA commands to the
+ *              control / status location, one transaction at a time as the
+ *              CCP does, and reports latency percentiles, NACK, CRC and
+ *              timeout rates and frames per second.
+ *
+ *              The link is a serial device or pseudo terminal (wts_host's
+ *              default), or host:port for a TCP link (wts_host -t port).
+ *
+ *              Usage: ccp_bench [options] link
+ *                  -n count  Transactions to run (default 1000).
+ *                  -r rate   Transactions a second, 0 for as fast as the
+ *                            WTS answers (default 0).
+ *                  -m mix    Commands to cycle through, any of r, w and
+ *                            x (WR_RD_DATA), (default "rwx").
+ *                  -w ms     Response timeout (default 100).
+ *                  -b baud   Set the serial device baud rate.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ccp_link.h"
+#include "gsebus.h"
+#include "wts_comms.h"
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *mix = "rwx";
+    unsigned long count = 1000, done = 0, answered = 0, i;
+    unsigned long results[CCP_RESULTS] = { 0 };
+    unsigned long tx_bytes = 0;
+    double rate = 0, timeout = 0.1;
+    double *lat, t_start, t_next, t_end;
+    int baud = 0, fd, opt;
+
+    while((opt = getopt(argc, argv, "n:r:m:w:b:")) != -1){
+        switch(opt){
+            case 'n': count   = strtoul(optarg, NULL, 0); break;
+            case 'r': rate    = atof(optarg);             break;
+            case 'm': mix     = optarg;                   break;
+            case 'w': timeout = atof(optarg) / 1000;      break;
+            case 'b': baud    = atoi(optarg);             break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if(optind != argc - 1 || count == 0 || mix[0] == '\0' ||
+       strspn(mix, "rwx") != strlen(mix)){
+        fprintf(stderr, "usage: ccp_bench [-n count] [-r rate] [-m rwx] "
+                        "[-w ms] [-b baud] link\n");
+        return 2;
+    }
+    fd  = ccp_link_open(argv[optind], baud);
+    lat = malloc(count * sizeof(*lat));
+
+    t_start = t_next = ccp_now();
+    for(done = 0; done < count; done++){
+        struct comms_wts_ctrl ctrl;
+        uint8_t payload[1 + sizeof(ctrl)];
+        uint8_t frame[CCP_FRAME_MAX];
+        uint8_t size = 1;
+        uint8_t cmd;
+        enum ccp_result res;
+        double t;
+        int n;
+
+        /*-- Next command of the mix.  Writes leave everything off. */
+        switch(mix[done % strlen(mix)]){
+            case 'r': cmd = WTS_CMD_RD_DATA;    break;
+            case 'w': cmd = WTS_CMD_WR_DATA;    break;
+            default:  cmd = WTS_CMD_WR_RD_DATA; break;
+        }
+        payload[0] = WTS_DADR_CTRL_STATUS;
+        if(cmd != WTS_CMD_RD_DATA){
+            memset(&ctrl, 0, sizeof(ctrl));
+            memcpy(&payload[1], &ctrl, sizeof(ctrl));
+            size += sizeof(ctrl);
+        }
+        n = ccp_frame_form(frame, cmd, payload, size);
+
+        /*-- Pace the requests. */
+        if(rate > 0){
+            while((t = ccp_now()) < t_next){
+                usleep((useconds_t)((t_next - t) * 1e6));
+            }
+            t_next += 1 / rate;
+        }
+
+        t = ccp_now();
+        if(write(fd, frame, n) != n){
+            perror("ccp_bench: write");
+            return 1;
+        }
+        tx_bytes += n;
+        res = ccp_frame_await(fd, t + timeout, NULL, NULL);
+        results[res]++;
+        if(res != CCP_TIMEOUT){
+            lat[answered++] = ccp_now() - t;
+        }
+        if(res != CCP_ACK && res != CCP_NACK){
+            ccp_link_resync(fd);
+        }
+    }
+    t_end = ccp_now();
+
+    /*-- Report. */
+    printf("ccp_bench: %lu transactions (%s) in %.3f s, %.1f per second\n",
+           count, mix, t_end - t_start, count / (t_end - t_start));
+    printf("  responses %.1f frames/s, requests %.0f bytes/s\n",
+           answered / (t_end - t_start), tx_bytes / (t_end - t_start));
+    for(i = 0; i < CCP_RESULTS; i++){
+        printf("  %-14s %8lu  %6.2f%%\n", ccp_result_name[i], results[i],
+               100.0 * results[i] / count);
+    }
+    if(answered){
+        static const double pct[] = { 50, 90, 99, 99.9 };
+        qsort(lat, answered, sizeof(*lat), cmp_double);
+        printf("  latency (ms)  ");
+        for(i = 0; i < sizeof(pct) / sizeof(pct[0]); i++){
+            printf(" p%g %.3f ", pct[i],
+                   lat[(unsigned long)(pct[i] / 100 * (answered - 1))] * 1e3);
+        }
+        printf(" max %.3f\n", lat[answered - 1] * 1e3);
+    }
+    free(lat);
+    close(fd);
+    return results[CCP_ACK] == count? 0: 1;
+}
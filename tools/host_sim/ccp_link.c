@@ -0,0 +1,236 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    ccp_link.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: CCP end of the GSEBUS link.  See ccp_link.h.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "ccp_link.h"
+#include "gsebus.h"
+#include "crc_api.h"
+
+const char *const ccp_result_name[CCP_RESULTS] = {
+    "ACK", "NACK", "CRC error", "framing error", "timeout"
+};
+
+double ccp_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ccp_link_open
+ *  FUNCTIONAL DESCRIPTION: Open the link to the WTS, raw.
+ *  FORMAL PARAMETERS:      name : Device path, or host:port for TCP.
+ *                          baud : Baud rate for a serial device, 0 to leave.
+ *  RETURN VALUE:           fd
+ ******************************************************************************
+ */
+int ccp_link_open(const char *name, int baud)
+{
+    const char *colon = strrchr(name, ':');
+    struct termios tio;
+    int fd;
+
+    if(name[0] != '/' && colon){
+        struct addrinfo hints, *ai;
+        char host[256];
+        int one = 1;
+
+        snprintf(host, sizeof(host), "%.*s", (int)(colon - name), name);
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        if(getaddrinfo(host, colon + 1, &hints, &ai)){
+            fprintf(stderr, "ccp_link: cannot find %s\n", name);
+            exit(1);
+        }
+        fd = socket(ai->ai_family, SOCK_STREAM, 0);
+        if(fd < 0 || connect(fd, ai->ai_addr, ai->ai_addrlen)){
+            perror("ccp_link: connect");
+            exit(1);
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        freeaddrinfo(ai);
+        return fd;
+    }
+
+    fd = open(name, O_RDWR | O_NOCTTY);
+    if(fd < 0 || tcgetattr(fd, &tio)){
+        perror("ccp_link: open");
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    if(baud){
+        static const struct { int baud; speed_t speed; } bauds[] = {
+            { 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 } };
+        unsigned i;
+        for(i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++){
+            if(bauds[i].baud == baud){
+                cfsetspeed(&tio, bauds[i].speed);
+                break;
+            }
+        }
+    }
+    tcsetattr(fd, TCSANOW, &tio);
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ccp_frame_form
+ *  FUNCTIONAL DESCRIPTION: Form a GSEBUS request from the CCP to the WTS.
+ *  FORMAL PARAMETERS:      buf     : Frame buffer, CCP_FRAME_MAX bytes.
+ *                          cmd     : WTS_CMD_xxx.
+ *                          payload : Location ID and any data.
+ *                          size    : Size of payload.
+ *  RETURN VALUE:           Frame size, STX to ETX.
+ ******************************************************************************
+ */
+int ccp_frame_form(uint8_t *buf, uint8_t cmd, const void *payload,
+                   uint8_t size)
+{
+    gsebus_header_t *hdr = (gsebus_header_t *)&buf[1];
+
+    buf[0]      = GSEBUS_STX;
+    hdr->saddr  = GSEBUS_ADDR_ID_CCP;
+    hdr->taddr  = GSEBUS_ADDR_ID_WTS;
+    hdr->cmd    = cmd;
+    hdr->len    = sizeof(*hdr) + size + crc_overhead;
+    memcpy(hdr + 1, payload, size);
+    gsebus_crc_generate(hdr, sizeof(*hdr) + size);
+    buf[hdr->len + 1] = GSEBUS_ETX;
+    return hdr->len + 2;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ccp_frame_await
+ *  FUNCTIONAL DESCRIPTION: Wait for the WTS response to a request.
+ *  FORMAL PARAMETERS:      fd        : Link.
+ *                          deadline  : ccp_now() to give up at.
+ *                          resp      : Where to put the response payload,
+ *                                      CCP_PAYLOAD_MAX bytes, (or NULL).
+ *                          resp_size : Where to put its size, (or NULL).
+ *  RETURN VALUE:           CCP_xxx
+ ******************************************************************************
+ */
+enum ccp_result ccp_frame_await(int fd, double deadline,
+                                uint8_t *resp, uint8_t *resp_size)
+{
+    uint8_t buf[CCP_FRAME_MAX];
+    gsebus_header_t *hdr = (gsebus_header_t *)&buf[1];
+    int index = 0;
+
+    for(;;){
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int wait = (int)((deadline - ccp_now()) * 1000) + 1;
+        uint8_t ch;
+
+        if(wait <= 0 || poll(&pfd, 1, wait) <= 0){
+            if(ccp_now() >= deadline){
+                return CCP_TIMEOUT;
+            }
+            continue;
+        }
+        if(read(fd, &ch, 1) != 1){
+            return CCP_TIMEOUT;         /* (Link gone.)                   */
+        }
+        if(index == 0 && ch != GSEBUS_STX){
+            continue;                   /* Wait for start of frame.       */
+        }
+        buf[index++] = ch;
+        if(index > 4 && index > hdr->len + 1){
+            uint8_t size = hdr->len - sizeof(*hdr) - crc_overhead;
+
+            if(hdr->len <= sizeof(*hdr) + crc_overhead - 1 ||
+               buf[hdr->len + 1] != GSEBUS_ETX ||
+               hdr->taddr != GSEBUS_ADDR_ID_CCP){
+                return CCP_FRAMING;
+            }
+            if(gsebus_crc_isInvalid(hdr, hdr->len - crc_overhead)){
+                return CCP_CRC;
+            }
+            if(resp != NULL){
+                memcpy(resp, hdr + 1, size);
+            }
+            if(resp_size != NULL){
+                *resp_size = size;
+            }
+            return hdr->cmd == GSEBUS_ACK? CCP_ACK: CCP_NACK;
+        }
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ccp_link_resync
+ *  FUNCTIONAL DESCRIPTION: Get back in step after a bad or missing
+ *                          response, by letting the link go quiet and
+ *                          losing anything left of the frame.
+ *  FORMAL PARAMETERS:      fd : Link.
+ *  RETURN VALUE:           None
+ ******************************************************************************
+ */
+void ccp_link_resync(int fd)
+{
+    usleep(20000);
+    tcflush(fd, TCIFLUSH);
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          ccp_transact
+ *  FUNCTIONAL DESCRIPTION: Send a request to the WTS and wait for its
+ *                          response, getting back in step if it is bad.
+ *  FORMAL PARAMETERS:      fd        : Link.
+ *                          cmd       : WTS_CMD_xxx.
+ *                          payload   : Location ID and any data.
+ *                          size      : Size of payload.
+ *                          resp      : As ccp_frame_await.
+ *                          resp_size : As ccp_frame_await.
+ *                          timeout   : Seconds to wait for response.
+ *  RETURN VALUE:           CCP_xxx
+ ******************************************************************************
+ */
+enum ccp_result ccp_transact(int fd, uint8_t cmd, const void *payload,
+                             uint8_t size, uint8_t *resp, uint8_t *resp_size,
+                             double timeout)
+{
+    uint8_t frame[CCP_FRAME_MAX];
+    int n = ccp_frame_form(frame, cmd, payload, size);
+    enum ccp_result res;
+
+    if(write(fd, frame, n) != n){
+        perror("ccp_link: write");
+        exit(1);
+    }
+    res = ccp_frame_await(fd, ccp_now() + timeout, resp, resp_size);
+    if(res != CCP_ACK && res != CCP_NACK){
+        ccp_link_resync(fd);
+    }
+    return res;
+}
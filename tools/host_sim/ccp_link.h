@@ -0,0 +1,47 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    ccp_link.h  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: CCP end of the GSEBUS link, for the Linux CCP stand in
+ *              tools.  The link is a serial device or pseudo terminal, or
+ *              host:port for TCP (see wts_host).
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#ifndef CCP_LINK_H
+#define CCP_LINK_H
+
+#include <stdint.h>
+
+#define CCP_FRAME_MAX       (256 + 2)   /* STX to ETX.                    */
+#define CCP_PAYLOAD_MAX     (256 - 8)   /* Largest payload in a frame.    */
+
+/*-- Outcome of one transaction. */
+enum ccp_result {
+    CCP_ACK,
+    CCP_NACK,
+    CCP_CRC,            /* Response with bad CRC.               */
+    CCP_FRAMING,        /* Response not for us, or no ETX.      */
+    CCP_TIMEOUT,        /* No (complete) response in time.      */
+    CCP_RESULTS
+};
+
+extern const char *const ccp_result_name[CCP_RESULTS];
+
+double ccp_now(void);
+int ccp_link_open(const char *name, int baud);
+int ccp_frame_form(uint8_t *buf, uint8_t cmd, const void *payload,
+                   uint8_t size);
+enum ccp_result ccp_frame_await(int fd, double deadline,
+                                uint8_t *resp, uint8_t *resp_size);
+void ccp_link_resync(int fd);
+enum ccp_result ccp_transact(int fd, uint8_t cmd, const void *payload,
+                             uint8_t size, uint8_t *resp, uint8_t *resp_size,
+                             double timeout);
+
+#endif  /* #ifndef CCP_LINK_H */
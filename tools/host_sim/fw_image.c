@@ -0,0 +1,317 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    fw_image.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Firmware image loading and packing.  See fw_image.h.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fw_image.h"
+#include "crc_api.h"
+
+#define FWZ_LITERAL_MAX     (WTS_FWZ_SHORT)
+#define FWZ_SHORT_BACK      (256)
+#define FWZ_SHORT_LEN_MAX   (WTS_FWZ_LEN_MASK + WTS_FWZ_SHORT_MIN)
+#define FWZ_LONG_LEN_MAX    (WTS_FWZ_LEN_MASK + WTS_FWZ_LONG_MIN)
+#define FWZ_CHAIN_MAX       (1024)      /* Candidates tried per match.    */
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fw_txt_load
+ *  FUNCTIONAL DESCRIPTION: Read IAR TI-TXT output ("@addr" lines, hex
+ *                          bytes, "q").  The copy of the code at 0xC000
+ *                          and the running code at 0xE000 are the same
+ *                          image, so both land on it.
+ *  FORMAL PARAMETERS:      f     : Open file.
+ *                          name  : (For messages.)
+ *                          image : FW_IMAGE_SIZE bytes, 0xFF filled.
+ *  RETURN VALUE:           Z if OK.
+ ******************************************************************************
+ */
+static int fw_txt_load(FILE *f, const char *name, uint8_t *image)
+{
+    static uint8_t seen[FW_IMAGE_SIZE];
+    char line[256], *s, *end;
+    unsigned long addr = 0, val;
+    unsigned n = 0;
+
+    memset(seen, 0, sizeof(seen));
+    while(fgets(line, sizeof(line), f) != NULL){
+        n++;
+        if(line[0] == '@'){
+            addr = strtoul(&line[1], NULL, 16);
+            continue;
+        }
+        if(line[0] == 'q'){
+            return 0;
+        }
+        for(s = line; (val = strtoul(s, &end, 16)), end != s; s = end){
+            unsigned off = addr & (FW_IMAGE_SIZE - 1);
+            if(addr < FW_IMAGE_ORIGIN || addr > 0xFFFF || val > 0xFF){
+                fprintf(stderr, "%s:%u: %04lX is not code flash\n",
+                        name, n, addr);
+                return 1;
+            }
+            if(seen[off] && image[off] != val){
+                fprintf(stderr, "%s:%u: %04lX differs from the other copy\n",
+                        name, n, addr);
+                return 1;
+            }
+            image[off] = val;
+            seen[off]  = 1;
+            addr++;
+        }
+    }
+    fprintf(stderr, "%s: no \"q\" at the end\n", name);
+    return 1;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fw_image_load
+ *  FUNCTIONAL DESCRIPTION: Read a firmware image, from a .fwi (the 8K image
+ *                          for 0xC000) or IAR TI-TXT output.
+ *  FORMAL PARAMETERS:      name  : File name.
+ *                          image : Where to put FW_IMAGE_SIZE bytes.
+ *  RETURN VALUE:           Z if OK, else it has said what is wrong.
+ *  Notes:                  The image CRC is not checked, TI-TXT straight
+ *                          from the linker will not have one in place.
+ ******************************************************************************
+ */
+int fw_image_load(const char *name, uint8_t *image)
+{
+    FILE *f = fopen(name, "rb");
+    int c, err;
+
+    if(f == NULL){
+        perror(name);
+        return 1;
+    }
+    memset(image, 0xFF, FW_IMAGE_SIZE);
+    c = getc(f);
+    ungetc(c, f);
+    if(c == '@'){
+        err = fw_txt_load(f, name, image);
+    } else {
+        err = fread(image, 1, FW_IMAGE_SIZE, f) != FW_IMAGE_SIZE ||
+              getc(f) != EOF;
+        if(err){
+            fprintf(stderr, "%s is not a %d byte .fwi image\n", name,
+                    FW_IMAGE_SIZE);
+        }
+    }
+    fclose(f);
+    return err;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fw_image_crc_fix
+ *  FUNCTIONAL DESCRIPTION: Set the FW_IMAGE_FIXUP word so the image CRC,
+ *                          (all but the last word), comes out as the last
+ *                          word, the reset vector.
+ *  FORMAL PARAMETERS:      image : Whole image, FW_IMAGE_FIXUP unused.
+ *  RETURN VALUE:           Z if OK, NZ if the fix up word is in use.
+ *  Notes:                  Tries every fix up value, the CRC up to it need
+ *                          only be worked out once, so it is a few million
+ *                          table steps.  One is always found, CRC-16 over
+ *                          two free bytes reaches every value.
+ ******************************************************************************
+ */
+int fw_image_crc_fix(uint8_t *image)
+{
+    const uint16_t want = image[FW_IMAGE_SIZE - 2] |
+                          image[FW_IMAGE_SIZE - 1] << 8;
+    uint16_t crc = crc_rev_init;
+    unsigned fix;
+    int i;
+
+    if(image[FW_IMAGE_FIXUP] != 0xFF || image[FW_IMAGE_FIXUP + 1] != 0xFF){
+        return 1;
+    }
+    for(i = 0; i < FW_IMAGE_FIXUP; i++){
+        crc = crc_rev_step(crc, image[i]);
+    }
+    for(fix = 0; fix <= 0xFFFF; fix++){
+        uint16_t c = crc_rev_step(crc, fix & 0xFF);
+
+        c = crc_rev_step(c, fix >> 8);
+        for(i = FW_IMAGE_FIXUP + 2; i < FW_IMAGE_SIZE - 2; i++){
+            c = crc_rev_step(c, image[i]);
+        }
+        if(c == want){
+            image[FW_IMAGE_FIXUP]     = fix;
+            image[FW_IMAGE_FIXUP + 1] = fix >> 8;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fwz_match
+ *  FUNCTIONAL DESCRIPTION: Find the best copy for image[at] on, from
+ *                          earlier in the image.
+ *  FORMAL PARAMETERS:      image : Whole image.
+ *                          prev  : Last earlier position with the same
+ *                                  first three bytes, -1 if none.
+ *                          at    : Position.
+ *                          limit : Most bytes the copy may give.
+ *                          back  : Where to put how far back it is.
+ *  RETURN VALUE:           Bytes it gives, 0 if no copy is worth it.
+ ******************************************************************************
+ */
+static int fwz_match(const uint8_t *image, const int *prev, int at,
+                     int limit, int *back)
+{
+    int best = 0, best_gain = 0, tries, q;
+
+    for(q = prev[at], tries = 0; q >= 0 && tries < FWZ_CHAIN_MAX;
+        q = prev[q], tries++){
+        int d = at - q;
+        int max = (d <= FWZ_SHORT_BACK)? FWZ_SHORT_LEN_MAX: FWZ_LONG_LEN_MAX;
+        int len = 0, gain;
+
+        if(max > limit){
+            max = limit;
+        }
+        while(len < max && image[q + len] == image[at + len]){
+            len++;                      /* (Overlap is fine, a run.)      */
+        }
+        if(d <= FWZ_SHORT_BACK){
+            gain = (len >= WTS_FWZ_SHORT_MIN)? len - 2: 0;
+        } else {
+            gain = (len >= WTS_FWZ_LONG_MIN)? len - 3: 0;
+        }
+        if(gain > best_gain){
+            best_gain = gain;
+            best      = len;
+            *back     = d;
+        }
+    }
+    return best;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fwz_pack_seg
+ *  FUNCTIONAL DESCRIPTION: Pack one segment of an image into compressed
+ *                          blocks, (see WTS_DADR_FW_BLOCK_Z).
+ *  FORMAL PARAMETERS:      image : Whole image.
+ *                          seg   : Segment.
+ *                          blk   : Where to put up to FWZ_SEG_BLOCKS blocks.
+ *  RETURN VALUE:           Number of blocks.
+ *  Notes:                  Copies may reach back into earlier segments, so
+ *                          the blocks must go to the WTS in address order,
+ *                          with the segments before holding the image.
+ ******************************************************************************
+ */
+int fwz_pack_seg(const uint8_t *image, int seg, struct fwz_block *blk)
+{
+    static int prev[FW_IMAGE_SIZE];
+    static int head[1 << 16];
+    const int seg_end = (seg + 1) * WTS_FW_SEG_SIZE;
+    int at = seg * WTS_FW_SEG_SIZE;
+    int n = 0, i;
+
+    /*-- Chain each position to the last one starting the same way. */
+    memset(head, -1, sizeof(head));
+    for(i = 0; i < seg_end; i++){
+        unsigned h = (i + 2 < FW_IMAGE_SIZE)?
+            (image[i] << 8 ^ image[i + 1] << 4 ^ image[i + 2]) & 0xFFFF:
+            0xFFFF;
+        prev[i] = head[h];
+        head[h] = i;
+    }
+
+    while(at < seg_end){
+        struct fwz_block *b = &blk[n++];
+        int start = at, lit = -1;       /* (Control byte of literal run.) */
+        int len, back = 0;
+
+        b->zlen = 0;
+        while(at < seg_end){
+            len = fwz_match(image, prev, at, seg_end - at, &back);
+            if(len){
+                int cost = (back <= FWZ_SHORT_BACK)? 2: 3;
+                if(b->zlen + cost + 2 > FWZ_DATA_MAX){
+                    break;              /* (2 spare for an odd byte.)     */
+                }
+                if(back <= FWZ_SHORT_BACK){
+                    b->data[b->zlen++] = WTS_FWZ_SHORT |
+                                         (len - WTS_FWZ_SHORT_MIN);
+                    b->data[b->zlen++] = back - 1;
+                } else {
+                    b->data[b->zlen++] = WTS_FWZ_LONG |
+                                         (len - WTS_FWZ_LONG_MIN);
+                    b->data[b->zlen++] = (back - 1) & 0xFF;
+                    b->data[b->zlen++] = (back - 1) >> 8;
+                }
+                at += len;
+                lit = -1;
+                continue;
+            }
+            if(lit < 0 || b->data[lit] == FWZ_LITERAL_MAX - 1){
+                if(b->zlen + 2 + 2 > FWZ_DATA_MAX){
+                    break;
+                }
+                lit = b->zlen++;
+                b->data[lit] = 0;
+            } else {
+                if(b->zlen + 1 + 2 > FWZ_DATA_MAX){
+                    break;
+                }
+                b->data[lit]++;
+            }
+            b->data[b->zlen++] = image[at++];
+        }
+
+        /*-- Blocks are whole words. */
+        if((at - start) & 1){
+            if(lit < 0 || b->data[lit] == FWZ_LITERAL_MAX - 1){
+                lit = b->zlen++;
+                b->data[lit] = 0;
+            } else {
+                b->data[lit]++;
+            }
+            b->data[b->zlen++] = image[at++];
+        }
+        b->addr = FW_IMAGE_ORIGIN + start;
+        b->len  = at - start;
+        b->crc  = gsebus_crc_calc(&image[start], b->len);
+    }
+    return n;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          fwz_block_form
+ *  FUNCTIONAL DESCRIPTION: Form the WTS_DADR_FW_BLOCK_Z request for a block.
+ *  FORMAL PARAMETERS:      blk     : Block.
+ *                          payload : Where to put it, CCP_PAYLOAD_MAX bytes.
+ *  RETURN VALUE:           Payload size.
+ ******************************************************************************
+ */
+int fwz_block_form(const struct fwz_block *blk, uint8_t *payload)
+{
+    payload[0] = WTS_DADR_FW_BLOCK_Z;
+    payload[1] = blk->addr;             /* struct comms_fw_upgrade_z.     */
+    payload[2] = blk->addr >> 8;
+    payload[3] = blk->len;
+    payload[4] = blk->len >> 8;
+    payload[5] = blk->crc;
+    payload[6] = blk->crc >> 8;
+    payload[7] = blk->zlen;
+    memcpy(&payload[1 + FWZ_HEADER], blk->data, blk->zlen);
+    return 1 + FWZ_HEADER + blk->zlen;
+}
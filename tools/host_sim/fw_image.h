@@ -0,0 +1,53 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    fw_image.h  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Firmware images for the Linux CCP stand in tools, read from
+ *              a .fwi or straight from the IAR TI-TXT output
+ *              (WaterTreatmentSystem.txt), and packed into compressed
+ *              WTS_DADR_FW_BLOCK_Z blocks.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#ifndef FW_IMAGE_H
+#define FW_IMAGE_H
+
+#include <stdint.h>
+
+#include "ccp_link.h"
+#include "wts_comms.h"
+
+#define FW_IMAGE_ORIGIN     WTS_FW_NEW_COPY
+#define FW_IMAGE_SIZE       (WTS_FW_SEGS * WTS_FW_SEG_SIZE)
+
+/*-- The image CRC must be the reset vector, (see do_reflash).  The word */
+/*   just before the vector table (0xFFDE) is left free for the linker,  */
+/*   and set to make it so.                                              */
+#define FW_IMAGE_FIXUP      (FW_IMAGE_SIZE - 0x22)
+
+/*-- Most compressed data a frame has room for, after the location ID and */
+/*   the struct comms_fw_upgrade_z header.                                */
+#define FWZ_HEADER          (7)
+#define FWZ_DATA_MAX        (CCP_PAYLOAD_MAX - 1 - FWZ_HEADER)
+#define FWZ_SEG_BLOCKS      (4)         /* Most blocks a segment takes.   */
+
+/*-- One compressed block, as struct comms_fw_upgrade_z. */
+struct fwz_block {
+    uint16_t addr;
+    uint16_t len;
+    uint16_t crc;
+    uint8_t  zlen;
+    uint8_t  data[FWZ_DATA_MAX];
+};
+
+int fw_image_load(const char *name, uint8_t *image);
+int fw_image_crc_fix(uint8_t *image);
+int fwz_pack_seg(const uint8_t *image, int seg, struct fwz_block *blk);
+int fwz_block_form(const struct fwz_block *blk, uint8_t *payload);
+
+#endif  /* #ifndef FW_IMAGE_H */
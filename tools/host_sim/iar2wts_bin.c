@@ -0,0 +1,168 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    iar2wts_bin.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Linux stand in for the in house iar2wts_bin.exe.  Turns
+ *              the IAR TI-TXT output (WaterTreatmentSystem.txt) into the
+ *              .fwi image the CCP sends, merging the reflash code at
+ *              0xC000 with the code at 0xE000 and putting the CRC in place,
+ *              (see do_reflash).
+ *
+ *              Usage: iar2wts_bin [-t out.txt] [in.txt [out.fwi]]
+ *                     iar2wts_bin -c image...
+ *                  -t out.txt  Also write the image as TI-TXT for both
+ *                              halves of flash, for JTAG programming.
+ *                  -c          Check the CRC of each image, .fwi or TI-TXT,
+ *                              exit status 1 if any is bad.
+ *
+ *              in.txt defaults to WaterTreatmentSystem.txt, and out.fwi to
+ *              in.txt with .fwi in place of .txt, as the old tool did.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fw_image.h"
+#include "crc_api.h"
+
+#define IAR2WTS_TXT_LINE    (16)        /* Bytes per TI-TXT line.         */
+#define IAR2WTS_MAIN        (0xE000)    /* Running code, as reflash.c.    */
+
+/*-- Check each image named, say how each is. */
+static int check_images(int n, char *name[])
+{
+    static uint8_t image[FW_IMAGE_SIZE];
+    int bad = 0, i;
+
+    for(i = 0; i < n; i++){
+        if(fw_image_load(name[i], image)){
+            bad = 1;
+        } else if(gsebus_crc_isInvalid(image, FW_IMAGE_SIZE - 2)){
+            printf("%s: BAD CRC\n", name[i]);
+            bad = 1;
+        } else {
+            printf("%s: OK, reset %02X%02X\n", name[i],
+                   image[FW_IMAGE_SIZE - 1], image[FW_IMAGE_SIZE - 2]);
+        }
+    }
+    return bad;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          txt_write
+ *  FUNCTIONAL DESCRIPTION: Write the image as TI-TXT at both 0xC000 and
+ *                          0xE000, leaving out erased words.
+ *  FORMAL PARAMETERS:      name  : File name.
+ *                          image : Whole image.
+ *  RETURN VALUE:           Z if OK.
+ ******************************************************************************
+ */
+static int txt_write(const char *name, const uint8_t *image)
+{
+    static const unsigned base[] = {FW_IMAGE_ORIGIN, IAR2WTS_MAIN};
+    FILE *f = fopen(name, "w");
+    unsigned b, i, col = 0;
+    int gap;
+
+    if(f == NULL){
+        perror(name);
+        return 1;
+    }
+    for(b = 0; b < sizeof(base) / sizeof(base[0]); b++){
+        gap = 1;
+        for(i = 0; i < FW_IMAGE_SIZE; i += 2){
+            if(image[i] == 0xFF && image[i + 1] == 0xFF){
+                gap = 1;
+                continue;
+            }
+            if(gap){
+                fprintf(f, "%s@%04X\n", col? "\n": "", base[b] + i);
+                gap = col = 0;
+            }
+            fprintf(f, "%02X %02X ", image[i], image[i + 1]);
+            col += 2;
+            if(col == IAR2WTS_TXT_LINE){
+                fputc('\n', f);
+                col = 0;
+            }
+        }
+    }
+    fprintf(f, "%sq\n", col? "\n": "");
+    if(fclose(f) != 0){
+        perror(name);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t image[FW_IMAGE_SIZE];
+    const char *in = "WaterTreatmentSystem.txt", *txt = NULL;
+    char *out = NULL;
+    FILE *f;
+    int opt, check = 0;
+
+    while((opt = getopt(argc, argv, "ct:")) != -1){
+        switch(opt){
+            case 'c': check = 1;     break;
+            case 't': txt = optarg;  break;
+            default:
+                fprintf(stderr, "usage: iar2wts_bin [-t out.txt] "
+                                "[in.txt [out.fwi]]\n"
+                                "       iar2wts_bin -c image...\n");
+                return 2;
+        }
+    }
+    if(check){
+        return check_images(argc - optind, &argv[optind]);
+    }
+    if(argc - optind > 2){
+        fprintf(stderr, "iar2wts_bin: too many files\n");
+        return 2;
+    }
+    if(optind < argc){
+        in = argv[optind];
+    }
+    if(optind + 1 < argc){
+        out = argv[optind + 1];
+    } else {
+        const char *dot = strrchr(in, '.');
+        size_t len = (dot && !strchr(dot, '/'))? (size_t)(dot - in):
+                                                  strlen(in);
+        out = malloc(len + sizeof(".fwi"));
+        sprintf(out, "%.*s.fwi", (int)len, in);
+    }
+
+    if(fw_image_load(in, image)){
+        return 1;
+    }
+    if(gsebus_crc_isInvalid(image, FW_IMAGE_SIZE - 2) &&
+       fw_image_crc_fix(image)){
+        fprintf(stderr, "iar2wts_bin: %s uses 0x%04X, needed for the CRC "
+                        "fix up\n", in, IAR2WTS_MAIN + FW_IMAGE_FIXUP);
+        return 1;
+    }
+    if((f = fopen(out, "wb")) == NULL ||
+       fwrite(image, 1, FW_IMAGE_SIZE, f) != FW_IMAGE_SIZE ||
+       fclose(f) != 0){
+        perror(out);
+        return 1;
+    }
+    if(txt != NULL && txt_write(txt, image)){
+        return 1;
+    }
+    printf("iar2wts_bin: %s, reset %02X%02X, fix up %02X%02X\n", out,
+           image[FW_IMAGE_SIZE - 1], image[FW_IMAGE_SIZE - 2],
+           image[FW_IMAGE_FIXUP + 1], image[FW_IMAGE_FIXUP]);
+    return 0;
+}
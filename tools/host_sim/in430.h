@@ -0,0 +1,37 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    in430.h  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Stand in for the IAR <in430.h> intrinsics when building the
+ *              firmware on a Linux host.
+ *              The global interrupt enable is modelled by sim_gie, which the
+ *              simulation harness checks before it "fires" an ISR.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#ifndef SIM_IN430_H
+#define SIM_IN430_H
+
+#include "io430.h"
+
+#define GIE             (0x0008)    /* Status register interrupt enable. */
+
+typedef unsigned short istate_t;
+
+extern volatile unsigned short sim_gie;
+
+#define __disable_interrupt()       do{ sim_gie = 0; }while(0)
+#define __enable_interrupt()        do{ sim_gie = GIE; }while(0)
+#define __get_interrupt_state()     ((istate_t)sim_gie)
+#define __set_interrupt_state(s)    do{ sim_gie = (s) & GIE; }while(0)
+#define __no_operation()            do{ }while(0)
+#define __even_in_range(v, r)       (v)
+#define __bis_SR_register(b)        do{ if((b) & GIE) sim_gie = GIE; }while(0)
+#define __bic_SR_register(b)        do{ if((b) & GIE) sim_gie = 0; }while(0)
+
+#endif  /* #ifndef SIM_IN430_H */
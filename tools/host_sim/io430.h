@@ -0,0 +1,370 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    io430.h  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Stand in for the IAR <io430.h> when building the firmware
+ *              on a Linux host.  Every MSP430F149 peripheral register used
+ *              by the firmware becomes a plain volatile variable (see
+ *              sim_regs.c), and the bit definitions carry the same values
+ *              as the IAR device header so the firmware source compiles
+ *              unchanged.
+ *
+ *              The IAR keywords and pragmas used by the firmware are
+ *              neutralised here:  __interrupt and __no_init expand to
+ *              nothing, #pragma vector/location are ignored by gcc.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#ifndef SIM_IO430_H
+#define SIM_IO430_H
+
+/*--- Use the host C99 types, and stop the firmware's own stdint.h (which  */
+/*    assumes a 16 bit int and 32 bit long) from redefining them.          */
+#include <stdint.h>
+#ifndef __STDINT_H__
+#define __STDINT_H__
+#endif
+
+#ifndef __VER__
+#define __VER__     (999)           /* Pretend to be a "new" IAR compiler. */
+#endif
+
+#define __interrupt
+#define __no_init
+#define __monitor
+#define __ramfunc
+#define __raw
+
+/*--- Special function registers. 8 bit. */
+#define SIM_SFR8_LIST(X)                                                    \
+    X(IE1) X(IFG1) X(ME1) X(IE2) X(IFG2) X(ME2)                             \
+    X(P1IN) X(P1OUT) X(P1DIR) X(P1IFG) X(P1IES) X(P1IE) X(P1SEL)            \
+    X(P2IN) X(P2OUT) X(P2DIR) X(P2IFG) X(P2IES) X(P2IE) X(P2SEL)            \
+    X(P3IN) X(P3OUT) X(P3DIR) X(P3SEL)                                      \
+    X(P4IN) X(P4OUT) X(P4DIR) X(P4SEL)                                      \
+    X(P5IN) X(P5OUT) X(P5DIR) X(P5SEL)                                      \
+    X(P6IN) X(P6OUT) X(P6DIR) X(P6SEL)                                      \
+    X(UCTL0) X(UTCTL0) X(URCTL0) X(UMCTL0) X(UBR00) X(UBR10)                \
+    X(RXBUF0) X(TXBUF0)                                                     \
+    X(UCTL1) X(UTCTL1) X(URCTL1) X(UMCTL1) X(UBR01) X(UBR11)                \
+    X(RXBUF1) X(TXBUF1)                                                     \
+    X(DCOCTL) X(BCSCTL1) X(BCSCTL2)
+
+/*--- Special function registers. 16 bit. */
+#define SIM_SFR16_LIST(X)                                                   \
+    X(WDTCTL)                                                               \
+    X(FCTL1) X(FCTL2)                                                       \
+    X(TACTL) X(TAR) X(TAIV)                                                 \
+    X(TACCTL0) X(TACCTL1) X(TACCTL2) X(TACCR0) X(TACCR1) X(TACCR2)          \
+    X(TBCTL) X(TBR) X(TBIV)                                                 \
+    X(TBCCTL0) X(TBCCTL1) X(TBCCTL2) X(TBCCTL3)                             \
+    X(TBCCTL4) X(TBCCTL5) X(TBCCTL6)                                        \
+    X(TBCCR0) X(TBCCR1) X(TBCCR2) X(TBCCR3)                                 \
+    X(TBCCR4) X(TBCCR5) X(TBCCR6)                                           \
+    X(ADC12CTL0) X(ADC12CTL1) X(ADC12IFG) X(ADC12IE) X(ADC12IV)
+
+#define SIM_SFR8_DECLARE(r)     extern volatile unsigned char  r;
+#define SIM_SFR16_DECLARE(r)    extern volatile unsigned short r;
+SIM_SFR8_LIST(SIM_SFR8_DECLARE)
+SIM_SFR16_LIST(SIM_SFR16_DECLARE)
+
+/*--- Flash writes just land, so the controller is always ready for the */
+/*    next word of a block write, (WAIT reads set).                      */
+extern volatile unsigned short sim_fctl3;
+static inline volatile unsigned short *sim_fctl3_reg(void)
+{
+    sim_fctl3 |= 0x0008;                /* WAIT */
+    return &sim_fctl3;
+}
+#define FCTL3           (*sim_fctl3_reg())
+
+/*--- The ADC12 conversion memory and control registers are consecutive  */
+/*    on the chip, and the firmware relies on that, so they are arrays.   */
+extern volatile unsigned char  sim_adc12mctl[16];
+extern volatile unsigned short sim_adc12mem[16];
+#define ADC12MCTL0       (sim_adc12mctl[0])
+#define ADC12MCTL1       (sim_adc12mctl[1])
+#define ADC12MCTL2       (sim_adc12mctl[2])
+#define ADC12MCTL3       (sim_adc12mctl[3])
+#define ADC12MCTL4       (sim_adc12mctl[4])
+#define ADC12MCTL5       (sim_adc12mctl[5])
+#define ADC12MCTL6       (sim_adc12mctl[6])
+#define ADC12MCTL7       (sim_adc12mctl[7])
+#define ADC12MCTL8       (sim_adc12mctl[8])
+#define ADC12MCTL9       (sim_adc12mctl[9])
+#define ADC12MCTL10      (sim_adc12mctl[10])
+#define ADC12MCTL11      (sim_adc12mctl[11])
+#define ADC12MCTL12      (sim_adc12mctl[12])
+#define ADC12MCTL13      (sim_adc12mctl[13])
+#define ADC12MCTL14      (sim_adc12mctl[14])
+#define ADC12MCTL15      (sim_adc12mctl[15])
+#define ADC12MEM0        (sim_adc12mem[0])
+#define ADC12MEM1        (sim_adc12mem[1])
+#define ADC12MEM2        (sim_adc12mem[2])
+#define ADC12MEM3        (sim_adc12mem[3])
+#define ADC12MEM4        (sim_adc12mem[4])
+#define ADC12MEM5        (sim_adc12mem[5])
+#define ADC12MEM6        (sim_adc12mem[6])
+#define ADC12MEM7        (sim_adc12mem[7])
+#define ADC12MEM8        (sim_adc12mem[8])
+#define ADC12MEM9        (sim_adc12mem[9])
+#define ADC12MEM10       (sim_adc12mem[10])
+#define ADC12MEM11       (sim_adc12mem[11])
+#define ADC12MEM12       (sim_adc12mem[12])
+#define ADC12MEM13       (sim_adc12mem[13])
+#define ADC12MEM14       (sim_adc12mem[14])
+#define ADC12MEM15       (sim_adc12mem[15])
+
+/*--- Special function register bits. */
+#define WDTIE           (0x01)
+#define OFIE            (0x02)
+#define NMIIE           (0x10)
+#define ACCVIE          (0x20)
+#define URXIE0          (0x40)
+#define UTXIE0          (0x80)
+#define WDTIFG          (0x01)
+#define OFIFG           (0x02)
+#define NMIIFG          (0x10)
+#define URXIFG0         (0x40)
+#define UTXIFG0         (0x80)
+#define UTXE0           (0x40)
+#define URXE0           (0x80)
+#define URXIE1          (0x10)
+#define UTXIE1          (0x20)
+#define URXIFG1         (0x10)
+#define UTXIFG1         (0x20)
+
+/*--- Watchdog. */
+#define WDTIS0          (0x0001)
+#define WDTIS1          (0x0002)
+#define WDTSSEL         (0x0004)
+#define WDTCNTCL        (0x0008)
+#define WDTTMSEL        (0x0010)
+#define WDTNMI          (0x0020)
+#define WDTNMIES        (0x0040)
+#define WDTHOLD         (0x0080)
+#define WDTPW           (0x5A00)
+#define WDT_MRST_32     (WDTPW+WDTCNTCL)
+#define WDT_MRST_8      (WDTPW+WDTCNTCL+WDTIS0)
+#define WDT_MRST_0_5    (WDTPW+WDTCNTCL+WDTIS1)
+#define WDT_MRST_0_064  (WDTPW+WDTCNTCL+WDTIS1+WDTIS0)
+#define WDT_ARST_1000   (WDTPW+WDTCNTCL+WDTSSEL)
+#define WDT_ARST_250    (WDTPW+WDTCNTCL+WDTSSEL+WDTIS0)
+#define WDT_ARST_16     (WDTPW+WDTCNTCL+WDTSSEL+WDTIS1)
+#define WDT_ARST_1_9    (WDTPW+WDTCNTCL+WDTSSEL+WDTIS1+WDTIS0)
+
+/*--- Flash controller. */
+#define ERASE           (0x0002)
+#define MERAS           (0x0004)
+#define WRT             (0x0040)
+#define BLKWRT          (0x0080)
+#define FN0             (0x0001)
+#define FN1             (0x0002)
+#define FN2             (0x0004)
+#define FN3             (0x0008)
+#define FN4             (0x0010)
+#define FN5             (0x0020)
+#define FSSEL0          (0x0040)
+#define FSSEL1          (0x0080)
+#define FSSEL_0         (0x0000)
+#define FSSEL_1         (0x0040)
+#define FSSEL_2         (0x0080)
+#define FSSEL_3         (0x00C0)
+#define BUSY            (0x0001)
+#define KEYV            (0x0002)
+#define ACCVIFG         (0x0004)
+#define WAIT            (0x0008)
+#define LOCK            (0x0010)
+#define EMEX            (0x0020)
+#define FRKEY           (0x9600)
+#define FWKEY           (0xA500)
+#define FXKEY           (0x3300)
+
+/*--- USART (UART mode). */
+#define SWRST           (0x01)
+#define MM              (0x02)
+#define SYNC            (0x04)
+#define LISTEN          (0x08)
+#define CHAR            (0x10)
+#define SPB             (0x20)
+#define PEV             (0x40)
+#define PENA            (0x80)
+#define TXEPT           (0x01)
+#define STC             (0x02)
+#define TXWAKE          (0x04)
+#define URXSE           (0x08)
+#define SSEL0           (0x10)
+#define SSEL1           (0x20)
+#define CKPL            (0x40)
+#define CKPH            (0x80)
+#define RXERR           (0x01)
+#define RXWAKE          (0x02)
+#define URXWIE          (0x04)
+#define URXEIE          (0x08)
+#define BRK             (0x10)
+#define OE              (0x20)
+#define PE              (0x40)
+#define FE              (0x80)
+
+/*--- Timer A / Timer B. */
+#define TAIFG           (0x0001)
+#define TAIE            (0x0002)
+#define TACLR           (0x0004)
+#define MC0             (0x0010)
+#define MC1             (0x0020)
+#define ID0             (0x0040)
+#define ID1             (0x0080)
+#define TASSEL0         (0x0100)
+#define TASSEL1         (0x0200)
+#define MC_0            (0x0000)
+#define MC_1            (0x0010)
+#define MC_2            (0x0020)
+#define MC_3            (0x0030)
+#define ID_0            (0x0000)
+#define ID_1            (0x0040)
+#define ID_2            (0x0080)
+#define ID_3            (0x00C0)
+#define TASSEL_0        (0x0000)
+#define TASSEL_1        (0x0100)
+#define TASSEL_2        (0x0200)
+#define TASSEL_3        (0x0300)
+#define CCIFG           (0x0001)
+#define COV             (0x0002)
+#define OUT             (0x0004)
+#define CCI             (0x0008)
+#define CCIE            (0x0010)
+#define OUTMOD0         (0x0020)
+#define OUTMOD1         (0x0040)
+#define OUTMOD2         (0x0080)
+#define CAP             (0x0100)
+#define SCCI            (0x0400)
+#define SCS             (0x0800)
+#define OUTMOD_0        (0x0000)
+#define OUTMOD_1        (0x0020)
+#define OUTMOD_2        (0x0040)
+#define OUTMOD_3        (0x0060)
+#define OUTMOD_4        (0x0080)
+#define OUTMOD_5        (0x00A0)
+#define OUTMOD_6        (0x00C0)
+#define OUTMOD_7        (0x00E0)
+#define CCIS_0          (0x0000)
+#define CCIS_1          (0x1000)
+#define CCIS_2          (0x2000)
+#define CCIS_3          (0x3000)
+#define CM_0            (0x0000)
+#define CM_1            (0x4000)
+#define CM_2            (0x8000)
+#define CM_3            (0xC000)
+#define TAIV_NONE       (0x0000)
+#define TAIV_CCIFG1     (0x0002)
+#define TAIV_CCIFG2     (0x0004)
+#define TAIV_TAIFG      (0x000A)
+#define TBIFG           (0x0001)
+#define TBIE            (0x0002)
+#define TBCLR           (0x0004)
+#define TBSSEL_0        (0x0000)
+#define TBSSEL_1        (0x0100)
+#define TBSSEL_2        (0x0200)
+#define TBSSEL_3        (0x0300)
+#define CNTL_0          (0x0000)
+#define CNTL_1          (0x0800)
+#define CNTL_2          (0x1000)
+#define CNTL_3          (0x1800)
+#define TBCLGRP_0       (0x0000)
+#define TBIV_NONE       (0x0000)
+#define TBIV_TBCCR1     (0x0002)
+#define TBIV_TBCCR2     (0x0004)
+#define TBIV_TBCCR3     (0x0006)
+#define TBIV_TBCCR4     (0x0008)
+#define TBIV_TBCCR5     (0x000A)
+#define TBIV_TBCCR6     (0x000C)
+#define TBIV_TBIFG      (0x000E)
+
+/*--- ADC12. */
+#define ADC12SC         (0x0001)
+#define ENC             (0x0002)
+#define ADC12TOVIE      (0x0004)
+#define ADC12OVIE       (0x0008)
+#define ADC12ON         (0x0010)
+#define REFON           (0x0020)
+#define REF2_5V         (0x0040)
+#define MSC             (0x0080)
+#define SHT0_0          (0x0000)
+#define SHT0_1          (0x0100)
+#define SHT0_2          (0x0200)
+#define SHT0_3          (0x0300)
+#define SHT0_4          (0x0400)
+#define SHT1_0          (0x0000)
+#define SHT1_1          (0x1000)
+#define SHT1_2          (0x2000)
+#define SHT1_3          (0x3000)
+#define SHT1_4          (0x4000)
+#define ADC12BUSY       (0x0001)
+#define CONSEQ_0        (0x0000)
+#define CONSEQ_1        (0x0002)
+#define CONSEQ_2        (0x0004)
+#define CONSEQ_3        (0x0006)
+#define ADC12SSEL_0     (0x0000)
+#define ADC12SSEL_1     (0x0008)
+#define ADC12SSEL_2     (0x0010)
+#define ADC12SSEL_3     (0x0018)
+#define ADC12DIV_0      (0x0000)
+#define ADC12DIV_1      (0x0020)
+#define ADC12DIV_2      (0x0040)
+#define ADC12DIV_3      (0x0060)
+#define ADC12DIV_4      (0x0080)
+#define ADC12DIV_5      (0x00A0)
+#define ADC12DIV_6      (0x00C0)
+#define ADC12DIV_7      (0x00E0)
+#define ISSH            (0x0100)
+#define SHP             (0x0200)
+#define SHS_0           (0x0000)
+#define SHS_1           (0x0400)
+#define SHS_2           (0x0800)
+#define SHS_3           (0x0C00)
+#define CSTARTADD_0     (0x0000)
+#define INCH_0          (0)
+#define INCH_1          (1)
+#define INCH_2          (2)
+#define INCH_3          (3)
+#define INCH_4          (4)
+#define INCH_5          (5)
+#define INCH_6          (6)
+#define INCH_7          (7)
+#define INCH_8          (8)
+#define INCH_9          (9)
+#define INCH_10         (10)
+#define INCH_11         (11)
+#define SREF_0          (0x00)
+#define SREF_1          (0x10)
+#define SREF_2          (0x20)
+#define SREF_3          (0x30)
+#define SREF_4          (0x40)
+#define SREF_5          (0x50)
+#define SREF_6          (0x60)
+#define SREF_7          (0x70)
+#define EOS             (0x80)
+
+/*--- Interrupt vector offsets (as per the IAR device header). */
+#define PORT2_VECTOR        (1 * 2u)
+#define UART1TX_VECTOR      (2 * 2u)
+#define UART1RX_VECTOR      (3 * 2u)
+#define PORT1_VECTOR        (4 * 2u)
+#define TIMERA1_VECTOR      (5 * 2u)
+#define TIMERA0_VECTOR      (6 * 2u)
+#define ADC_VECTOR          (7 * 2u)
+#define UART0TX_VECTOR      (8 * 2u)
+#define UART0RX_VECTOR      (9 * 2u)
+#define WDT_VECTOR          (10 * 2u)
+#define COMPARATORA_VECTOR  (11 * 2u)
+#define TIMERB1_VECTOR      (12 * 2u)
+#define TIMERB0_VECTOR      (13 * 2u)
+#define NMI_VECTOR          (14 * 2u)
+#define RESET_VECTOR        (15 * 2u)
+
+#endif  /* #ifndef SIM_IO430_H */
@@ -0,0 +1,500 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    sim.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Simulated MSP430F149 peripherals for running the firmware
+ *              on a Linux host.  See sim.h.
+ *
+ *              Only as much of each peripheral is modelled as the firmware
+ *              uses:
+ *              Timer A:  Continuous mode, CCR0-2 compare and overflow
+ *                        interrupts.  OUT1 set by its compare in OUTMOD_1,
+ *                        the OUT bit standing for the output in any mode.
+ *              Timer B:  Continuous mode, 8/10/12/16 bit, CCR1-6 compare
+ *                        interrupts.
+ *              USART0:   UART Rx and Tx, one character every 10 bit times
+ *                        (modulation ignored), with Tx buffer and shift
+ *                        register, TXEPT.
+ *              ADC12:    Single sequence from ADC12MCTL0 to EOS, started
+ *                        by ADC12SC, or the rising edge of Timer A OUT1,
+ *                        (ENC toggling between sequences not checked).
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "io430.h"
+#include "in430.h"
+#include "sim.h"
+
+#include "pio.h"
+#include "timers.h"
+#include "clk_api.h"
+#include "cooling_air_valve.h"
+#include "rtc_api.h"
+#include "gsebus_ser.h"
+#include "comms.h"
+#include "steam_flow.h"
+#include "anin.h"
+#include "fail_safe.h"
+#include "wdg.h"
+#include "reflash.h"
+#include "fls_api.h"
+#include "crc_api.h"
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE (0x100000)
+#endif
+
+#define SIM_FLASH_START     (0x1000)    /* INFO flash, then code flash.   */
+#define SIM_FLASH_END       (0x10000)
+#define SIM_IMAGE_MAIN      (0xE000)    /* As reflash.c.                  */
+#define SIM_IMAGE_COPY      (0xC000)
+#define SIM_IMAGE_SIZE      (0x2000)
+
+#define SIM_UART_RX_QUEUE   (4096)      /* Power of 2.                    */
+
+uint8_t flash_err;                      /* (In main.c on the target.)     */
+
+uint64_t sim_cycles;
+uint32_t sim_loop_cycles = 400;
+sim_adc_input_fn sim_adc_input;
+sim_uart_tx_fn   sim_uart_tx;
+
+static volatile unsigned short *const ta_cctl[3] =
+    { &TACCTL0, &TACCTL1, &TACCTL2 };
+static volatile unsigned short *const ta_ccr[3] =
+    { &TACCR0, &TACCR1, &TACCR2 };
+static volatile unsigned short *const tb_cctl[7] =
+    { &TBCCTL0, &TBCCTL1, &TBCCTL2, &TBCCTL3, &TBCCTL4, &TBCCTL5, &TBCCTL6 };
+static volatile unsigned short *const tb_ccr[7] =
+    { &TBCCR0, &TBCCR1, &TBCCR2, &TBCCR3, &TBCCR4, &TBCCR5, &TBCCR6 };
+
+static struct {
+    uint8_t  rx_q[SIM_UART_RX_QUEUE];   /* Bytes on their way to the WTS. */
+    uint16_t rx_head;
+    uint16_t rx_tail;
+    uint32_t rx_left;           /* Cycles to next Rx char, 0 if idle.     */
+    uint8_t  shift_busy;        /* Tx shift register in use.              */
+    uint8_t  shift;
+    uint32_t shift_left;        /* Cycles until its stop bit is done.     */
+    uint8_t  buf_full;          /* TXBUF0 waiting for the shift register. */
+    uint8_t  buf;
+} uart;
+
+static uint32_t adc_left;       /* Cycles until sequence done, 0 if idle. */
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          sim_adc_default
+ *  FUNCTIONAL DESCRIPTION: Default ADC input, a fixed level per input, and
+ *                          per external mux channel.  The probes only give
+ *                          theirs while excited.
+ ******************************************************************************
+ */
+static uint16_t sim_adc_default(uint8_t inch, uint64_t cycle)
+{
+    (void)cycle;
+    if(inch == INCH_MUX){
+        return 0x400 + 0x80 * (P3OUT & 7);
+    }
+    if((inch == INCH_PROBE1 || inch == INCH_PROBE2) &&
+       !(P4OUT & P4O6_PROBE_SAMPLE)){
+        return 0x010;
+    }
+    return 0x800 + 0x40 * inch;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          sim_flash_init
+ *  FUNCTIONAL DESCRIPTION: Put host memory where the INFO and code flash
+ *                          are, and fill in blank firmware images with good
+ *                          CRCs, so reflash_startup_check is happy.
+ ******************************************************************************
+ */
+static void sim_flash_init(void)
+{
+    void *p = mmap((void *)SIM_FLASH_START, SIM_FLASH_END - SIM_FLASH_START,
+                   PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if(p != (void *)SIM_FLASH_START){
+        fprintf(stderr, "sim: cannot map flash at 0x%04X "
+                        "(check vm.mmap_min_addr)\n", SIM_FLASH_START);
+        exit(1);
+    }
+    memset(p, 0xFF, SIM_FLASH_END - SIM_FLASH_START);
+    gsebus_crc_generate((void *)SIM_IMAGE_MAIN, SIM_IMAGE_SIZE - 2);
+    gsebus_crc_generate((void *)SIM_IMAGE_COPY, SIM_IMAGE_SIZE - 2);
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          sim_uart_char_cycles
+ *  FUNCTIONAL DESCRIPTION: SMCLK cycles per character at the baud rate the
+ *                          firmware has set, (start, 8 data, stop).
+ ******************************************************************************
+ */
+uint32_t sim_uart_char_cycles(void)
+{
+    uint32_t ubr = UBR00 | (UBR10 << 8);
+
+    if(ubr < 3){
+        ubr = 3;                        /* (As the USART requires.)       */
+    }
+    return 10 * ubr;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          sim_uart_rx
+ *  FUNCTIONAL DESCRIPTION: Queue bytes to arrive at the WTS, back to back
+ *                          at the current baud rate.
+ ******************************************************************************
+ */
+void sim_uart_rx(const uint8_t *buf, uint16_t n)
+{
+    while(n--){
+        uint16_t next = (uart.rx_head + 1) & (SIM_UART_RX_QUEUE - 1);
+        if(next == uart.rx_tail){
+            fprintf(stderr, "sim: UART Rx queue full\n");
+            return;
+        }
+        uart.rx_q[uart.rx_head] = *buf++;
+        uart.rx_head = next;
+    }
+    if(uart.rx_left == 0){
+        uart.rx_left = sim_uart_char_cycles();
+    }
+}
+
+uint16_t sim_uart_rx_pending(void)
+{
+    return (uart.rx_head - uart.rx_tail) & (SIM_UART_RX_QUEUE - 1);
+}
+
+/*-- Next queued char has fully arrived. */
+static void uart_rx_char(void)
+{
+    RXBUF0 = uart.rx_q[uart.rx_tail];
+    uart.rx_tail = (uart.rx_tail + 1) & (SIM_UART_RX_QUEUE - 1);
+    IFG1 |= URXIFG0;                    /* (Overrun not modelled.)        */
+    uart.rx_left = (uart.rx_tail != uart.rx_head)? sim_uart_char_cycles(): 0;
+}
+
+/*-- ser_txIsr has just written TXBUF0. */
+static void uart_tx_loaded(void)
+{
+    if(!uart.shift_busy){
+        uart.shift      = TXBUF0;
+        uart.shift_busy = 1;
+        uart.shift_left = sim_uart_char_cycles();
+        IFG1 |= UTXIFG0;                /* Buffer free again at once.     */
+    } else {
+        uart.buf      = TXBUF0;
+        uart.buf_full = 1;
+    }
+}
+
+/*-- Stop bit of the char in the shift register is done. */
+static void uart_tx_done(void)
+{
+    if(sim_uart_tx){
+        sim_uart_tx(uart.shift, sim_cycles);
+    }
+    if(uart.buf_full){
+        uart.shift      = uart.buf;
+        uart.buf_full   = 0;
+        uart.shift_left = sim_uart_char_cycles();
+        IFG1 |= UTXIFG0;
+    } else {
+        uart.shift_busy = 0;
+    }
+}
+
+/*-- Start an ADC conversion sequence, if one is not running. */
+static void adc_start(void)
+{
+    static const uint16_t sht[16] = {
+        4, 8, 16, 32, 64, 96, 128, 192, 256, 384, 512, 768,
+        1024, 1024, 1024, 1024 };
+    uint32_t per_chnl, n = 0;
+
+    if(!(ADC12CTL0 & ENC) || adc_left != 0){
+        return;
+    }
+    do{
+        n++;
+    } while(n < 16 && !(sim_adc12mctl[n - 1] & EOS));
+    per_chnl  = sht[(ADC12CTL0 >> 8) & 0x0F] + 13;  /* ADC12CLK's.       */
+    per_chnl *= ((ADC12CTL1 >> 5) & 7) + 1;         /* ADC12DIV.         */
+    adc_left  = n * per_chnl;
+}
+
+/*-- Keep the read only bits of the peripherals up to date. */
+static void sim_sync(void)
+{
+    if(uart.shift_busy || uart.buf_full){
+        UTCTL0 &= ~TXEPT;
+    } else {
+        UTCTL0 |= TXEPT;
+    }
+
+    /*-- ADC conversion sequence started by software? */
+    if((ADC12CTL0 & ADC12SC) && (ADC12CTL1 & SHS_3) == SHS_0){
+        adc_start();
+        ADC12CTL0 &= ~ADC12SC;
+    }
+}
+
+/*-- Timer A CCRn compare output, (OUTMOD_1 only). */
+static void ta_out(uint8_t n)
+{
+    if((*ta_cctl[n] & OUTMOD_7) != OUTMOD_1 || (*ta_cctl[n] & OUT)){
+        return;
+    }
+    *ta_cctl[n] |= OUT;
+    if(n == 1 && (ADC12CTL1 & SHS_3) == SHS_1){
+        adc_start();                    /* Rising edge of OUT1.           */
+    }
+}
+
+/*-- ADC conversion sequence done. */
+static void adc_done(void)
+{
+    uint8_t i = 0;
+
+    do{
+        sim_adc12mem[i] = sim_adc_input(sim_adc12mctl[i] & 0x0F, sim_cycles)
+                          & 0x0FFF;
+        ADC12IFG |= 1 << i;
+    } while(!(sim_adc12mctl[i++] & EOS) && i < 16);
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          sim_irq_service
+ *  FUNCTIONAL DESCRIPTION: Call the ISRs for any interrupts due, highest
+ *                          priority (vector address) first.  GIE is off
+ *                          while each ISR runs, as on the target.
+ ******************************************************************************
+ */
+static void sim_irq_service(void)
+{
+    while(sim_gie){
+        void (*isr)(void) = NULL;
+        uint8_t tx = 0;
+        uint8_t n;
+
+        for(n = 1; n < 7; n++){             /* TIMERB1_VECTOR.            */
+            if((*tb_cctl[n] & (CCIE | CCIFG)) == (CCIE | CCIFG)){
+                *tb_cctl[n] &= ~CCIFG;
+                TBIV = n * 2;
+                isr = sim_isr_timerb1;
+                break;
+            }
+        }
+        if(isr){
+        } else if((IFG1 & URXIFG0) && (IE1 & URXIE0)){
+            IFG1 &= ~URXIFG0;               /* (Read of RXBUF0 clears.)   */
+            isr = ser_rxIsr;
+        } else if((IFG1 & UTXIFG0) && (IE1 & UTXIE0)){
+            IFG1 &= ~UTXIFG0;               /* (Write of TXBUF0 clears.)  */
+            isr = ser_txIsr;
+            tx = 1;
+        } else if(ADC12IFG & ADC12IE){
+            ADC12IFG = 0;                   /* (Reads of ADC12MEMx clear.)*/
+            isr = sim_isr_adc;
+        } else if((TACCTL0 & (CCIE | CCIFG)) == (CCIE | CCIFG)){
+            TACCTL0 &= ~CCIFG;
+            isr = sim_isr_timera0;
+        } else if((TACCTL1 & (CCIE | CCIFG)) == (CCIE | CCIFG)){
+            TACCTL1 &= ~CCIFG;
+            TAIV = TAIV_CCIFG1;
+            isr = sim_isr_timera1;
+        } else if((TACCTL2 & (CCIE | CCIFG)) == (CCIE | CCIFG)){
+            TACCTL2 &= ~CCIFG;
+            TAIV = TAIV_CCIFG2;
+            isr = sim_isr_timera1;
+        } else if((TACTL & (TAIE | TAIFG)) == (TAIE | TAIFG)){
+            TACTL &= ~TAIFG;
+            TAIV = TAIV_TAIFG;
+            isr = sim_isr_timera1;
+        } else {
+            break;                          /* Nothing due.               */
+        }
+
+        sim_gie = 0;
+        isr();
+        sim_gie = GIE;
+        if(tx){
+            uart_tx_loaded();
+        }
+        sim_sync();
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          sim_advance
+ *  FUNCTIONAL DESCRIPTION: Move simulated time on, stopping at each
+ *                          peripheral event to run any ISRs due.
+ *  FORMAL PARAMETERS:      cycles : SMCLK cycles.
+ ******************************************************************************
+ */
+void sim_advance(uint32_t cycles)
+{
+    sim_sync();
+    sim_irq_service();
+
+    while(cycles != 0){
+        uint32_t ta_d[4] = { 0 };       /* Cycles to each event, 0: none. */
+        uint32_t tb_d[7] = { 0 };
+        uint32_t step = cycles;
+        uint8_t  ta_on = (TACTL & MC_3) != 0;
+        uint8_t  tb_on = (TBCTL & MC_3) != 0;
+        uint16_t tb_mask;
+        uint8_t  n;
+
+        switch(TBCTL & CNTL_3){
+            case CNTL_1: tb_mask = 0x0FFF; break;
+            case CNTL_2: tb_mask = 0x03FF; break;
+            case CNTL_3: tb_mask = 0x00FF; break;
+            default:     tb_mask = 0xFFFF; break;
+        }
+        if(TACTL & TACLR){
+            TAR = 0;
+            TACTL &= ~TACLR;
+        }
+        if(TBCTL & TBCLR){
+            TBR = 0;
+            TBCTL &= ~TBCLR;
+        }
+
+        /*-- Find the next event. */
+        if(ta_on){
+            for(n = 0; n < 3; n++){
+                if(*ta_cctl[n] & (CCIE | OUTMOD_7)){
+                    uint16_t d = *ta_ccr[n] - TAR;
+                    ta_d[n] = d? d: 0x10000;
+                    if(ta_d[n] < step) step = ta_d[n];
+                }
+            }
+            if(TACTL & TAIE){
+                ta_d[3] = 0x10000 - TAR;
+                if(ta_d[3] < step) step = ta_d[3];
+            }
+        }
+        if(tb_on){
+            for(n = 0; n < 7; n++){
+                if(*tb_cctl[n] & CCIE){
+                    uint32_t d = (*tb_ccr[n] - TBR) & tb_mask;
+                    tb_d[n] = d? d: tb_mask + 1UL;
+                    if(tb_d[n] < step) step = tb_d[n];
+                }
+            }
+        }
+        if(uart.shift_busy && uart.shift_left < step) step = uart.shift_left;
+        if(uart.rx_left    && uart.rx_left    < step) step = uart.rx_left;
+        if(adc_left        && adc_left        < step) step = adc_left;
+
+        /*-- Move time on to it. */
+        sim_cycles += step;
+        cycles     -= step;
+        if(ta_on){
+            TAR = (uint16_t)(TAR + step);
+        }
+        if(tb_on){
+            TBR = (TBR + step) & tb_mask;
+        }
+
+        /*-- Flag whatever came due, (an ADC sequence ending before a */
+        /*   compare may start the next).                              */
+        if(adc_left && (adc_left -= step) == 0){
+            adc_done();
+        }
+        for(n = 0; n < 3; n++){
+            if(ta_d[n] == step){
+                *ta_cctl[n] |= CCIFG;
+                ta_out(n);
+            }
+        }
+        if(ta_d[3] == step) TACTL |= TAIFG;
+        for(n = 0; n < 7; n++){
+            if(tb_d[n] == step) *tb_cctl[n] |= CCIFG;
+        }
+        if(uart.shift_busy && (uart.shift_left -= step) == 0){
+            uart_tx_done();
+        }
+        if(uart.rx_left && (uart.rx_left -= step) == 0){
+            uart_rx_char();
+        }
+        sim_sync();
+        sim_irq_service();
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          sim_init
+ *  FUNCTIONAL DESCRIPTION: Set up the simulated chip, then start up the
+ *                          firmware as main.c does.
+ ******************************************************************************
+ */
+void sim_init(void)
+{
+    sim_flash_init();
+    if(sim_adc_input == NULL){
+        sim_adc_input = sim_adc_default;
+    }
+    IFG1 = UTXIFG0;                 /* USART Tx buffer empty from reset.  */
+
+    /*-- Start up enough stuff to check the flash. */
+    WDTCTL = WDTPW + WDTHOLD;
+    pio_setup_pin_directions();
+    wdg_hwTickle();
+    clk_init();
+    rtc_init();
+    fls_init();
+    reflash_startup_check();
+
+    /*-- Flash is OK, continue as normal.   */
+    timerA_init();
+    timerB_init();
+    fail_safe_init();
+    ser_init();
+    anin_init();
+    steam_flow_init();
+    cooling_air_valve_init();
+
+    __enable_interrupt();
+    sim_sync();
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          sim_main_loop
+ *  FUNCTIONAL DESCRIPTION: One pass of the main.c forever loop, then let
+ *                          the time it took pass.
+ ******************************************************************************
+ */
+void sim_main_loop(void)
+{
+    wdg_hwTickle();
+    rtc_state_machine();
+    comms_poll();
+    fls_state_machine();
+    reflash_state_machine();
+    anin_state_machine();
+    fail_safe_state_machine();
+    sim_advance(sim_loop_cycles);
+}
@@ -0,0 +1,61 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    sim.h  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Simulated MSP430F149 peripherals, so the real firmware
+ *              modules can be run and profiled on a Linux host.
+ *
+ *              Time is counted in SMCLK (8MHz) cycles.  sim_advance moves
+ *              time on, running Timer A, Timer B, USART0 and the ADC12,
+ *              and calls the firmware ISRs as their interrupts come due
+ *              (in MSP430 priority order, and only while sim_gie is set).
+ *              The main line runs between calls to sim_advance, each pass
+ *              of sim_main_loop being charged sim_loop_cycles.
+ *
+ *              Code and INFO flash (0x1000 - 0xFFFF) are plain host memory
+ *              mapped at the same addresses, so the flash and reflash code
+ *              work on their real addresses.  Flash erase is not modelled,
+ *              writes just land.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+#define SIM_SMCLK_HZ        (8000000UL)
+
+/*--- ISRs the firmware exports, and wrappers for its static ones. */
+void ser_rxIsr(void);
+void ser_txIsr(void);
+void sim_isr_timera0(void);     /* sim_timers.c */
+void sim_isr_timera1(void);
+void sim_isr_timerb1(void);
+void sim_isr_adc(void);         /* sim_anin.c   */
+
+/*--- ADC input source: Raw 12 bit reading for an ADC12 input channel    */
+/*    (INCH_xxx) at a given time.  The external mux address is on P3OUT. */
+typedef uint16_t (*sim_adc_input_fn)(uint8_t inch, uint64_t cycle);
+extern sim_adc_input_fn sim_adc_input;
+
+/*--- Bytes sent by the WTS, one call per character as its stop bit ends. */
+typedef void (*sim_uart_tx_fn)(uint8_t ch, uint64_t cycle);
+extern sim_uart_tx_fn sim_uart_tx;
+
+extern uint64_t sim_cycles;         /* SMCLK cycles since sim_init.       */
+extern uint32_t sim_loop_cycles;    /* Cost of one main loop pass.        */
+
+void sim_init(void);
+void sim_main_loop(void);
+void sim_advance(uint32_t cycles);
+void sim_uart_rx(const uint8_t *buf, uint16_t n);
+uint16_t sim_uart_rx_pending(void);
+uint32_t sim_uart_char_cycles(void);
+
+#endif  /* #ifndef SIM_H */
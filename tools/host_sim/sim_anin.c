@@ -0,0 +1,21 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    sim_anin.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Builds the firmware anin.c, and gives the simulation a
+ *              way to call its (static) ADC interrupt handler.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include "anin.c"
+#include "sim.h"
+
+void sim_isr_adc(void)
+{
+    ADC_interupt_handler();
+}
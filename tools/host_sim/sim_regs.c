@@ -0,0 +1,27 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    sim_regs.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Storage for the simulated MSP430F149 peripheral registers
+ *              declared in io430.h, and the global interrupt enable.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include "io430.h"
+#include "in430.h"
+
+#define SIM_SFR8_DEFINE(r)      volatile unsigned char  r;
+#define SIM_SFR16_DEFINE(r)     volatile unsigned short r;
+SIM_SFR8_LIST(SIM_SFR8_DEFINE)
+SIM_SFR16_LIST(SIM_SFR16_DEFINE)
+
+volatile unsigned char  sim_adc12mctl[16];
+volatile unsigned short sim_adc12mem[16];
+volatile unsigned short sim_fctl3;
+
+volatile unsigned short sim_gie;
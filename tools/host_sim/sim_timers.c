@@ -0,0 +1,31 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    sim_timers.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Builds the firmware timers.c, and gives the simulation a
+ *              way to call its (static) interrupt handlers.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include "timers.c"
+#include "sim.h"
+
+void sim_isr_timera0(void)
+{
+    TIMER0_interupt_handler();
+}
+
+void sim_isr_timera1(void)
+{
+    TIMER1_interupt_handler();
+}
+
+void sim_isr_timerb1(void)
+{
+    timerB1_interupt_handler();
+}
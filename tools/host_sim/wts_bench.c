@@ -0,0 +1,144 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    wts_bench.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Times the firmware hot paths on the host, then runs the
+ *              whole simulated WTS for a while.
+ *
+ *              Host times are only good for comparing one version of the
+ *              firmware with another, they are not MSP430 cycle counts.
+ *              Run it under perf, or build with "make PROFILE=1" for gprof,
+ *              to see where the time goes.
+ *
+ *              Usage: wts_bench [simulated seconds]
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "io430.h"
+#include "sim.h"
+
+#include "cfcl.h"
+#include "crc_api.h"
+#include "flt_api.h"
+#include "rtc_api.h"
+#include "anin.h"
+
+#define BENCH_IMAGE         ((void *)0xE000)
+#define BENCH_IMAGE_SIZE    (0x2000 - 2)
+
+static volatile unsigned bench_sink;    /* Stops results being optimised out. */
+
+/*-- Check the CRC kernel against the CRC-16/MODBUS check value, from an */
+/*   even address and (for slice-by-2) an odd one.                       */
+static const char *crc_check(void)
+{
+    uint16_t buf[6];
+    uint8_t *b = (uint8_t *)buf;
+
+    memcpy(b, "123456789", 9);
+    if(gsebus_crc_calc(b, 9) != 0x4B37){
+        return "FAILED";
+    }
+    memcpy(b + 1, "23456789", 8);       /* ("23456789" gives 0x2124.)    */
+    return (gsebus_crc_calc(b + 1, 8) == 0x2124)? "OK": "FAILED, odd";
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *name, double secs, unsigned long n,
+                   const char *per)
+{
+    printf("  %-36s %10.1f ns/%s\n", name, secs * 1e9 / n, per);
+}
+
+int main(int argc, char *argv[])
+{
+    double sim_secs = (argc > 1)? atof(argv[1]): 10.0;
+    unsigned long i, n;
+    double t;
+
+    sim_init();
+    printf("wts_bench: host times, for comparison between builds only\n");
+
+    /*-- CRC of a whole firmware image (CalcCrcRev), after checking the */
+    /*   kernel against the CRC-16/MODBUS check value.                  */
+    printf("  CRC_KERNEL %d, %u table bytes, check %s\n", CRC_KERNEL,
+           (unsigned)CRC_TABLE_BYTES, crc_check());
+    n = 2000;
+    t = now();
+    for(i = 0; i < n; i++){
+        bench_sink += gsebus_crc_isInvalid(BENCH_IMAGE, BENCH_IMAGE_SIZE);
+    }
+    report("gsebus_crc_isInvalid (8K image)", now() - t,
+           n * BENCH_IMAGE_SIZE, "byte");
+
+    /*-- One ADC set. */
+    n = 2000000;
+    t = now();
+    for(i = 0; i < n; i++){
+        sim_adc12mem[i & 7] = (uint16_t)(i * 2654435761u) >> 4;
+        anin_tirq();
+    }
+    report("anin_tirq", now() - t, n, "call");
+
+    /*-- Engineering units, as for a WTS_DADR_STATUS_EU read. */
+    n = 2000000;
+    t = now();
+    for(i = 0; i < n; i++){
+        struct comms_wts_status_eu eu;
+
+        anin_rd_to_eu(&eu);
+        bench_sink += eu.probe1_conductivity;
+    }
+    report("anin_rd_to_eu", now() - t, n, "call");
+
+    /*-- Timer state machine, a systick every call. */
+    n = 2000000;
+    t = now();
+    for(i = 0; i < n; i++){
+        systick++;
+        rtc_state_machine();
+    }
+    report("rtc_state_machine (systick each)", now() - t, n, "call");
+
+    /*-- Input debounce. */
+    n = 20000000;
+    t = now();
+    for(i = 0; i < n; i++){
+        bench_sink += flt_debounce((unsigned short)(i * 0x9E37u >> 3));
+    }
+    report("flt_debounce", now() - t, n, "call");
+
+    /*-- The whole thing, interrupts and all. */
+    {
+        uint64_t end = sim_cycles + (uint64_t)(sim_secs * SIM_SMCLK_HZ);
+        unsigned long loops = 0;
+
+        t = now();
+        while(sim_cycles < end){
+            sim_main_loop();
+            loops++;
+        }
+        t = now() - t;
+        report("sim_main_loop (with ISRs)", t, loops, "pass");
+        printf("  %.1f simulated seconds in %.2f s, %.1f x real time\n",
+               sim_secs, t, sim_secs / t);
+    }
+    return 0;
+}
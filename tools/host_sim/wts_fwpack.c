@@ -0,0 +1,87 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    wts_fwpack.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Packs a firmware image into compressed WTS_DADR_FW_BLOCK_Z
+ *              blocks, and says how many bytes that saves on the bus over
+ *              plain 128 byte WTS_DADR_FW_BLOCK blocks.
+ *
+ *              The image is a .fwi, or the IAR TI-TXT output
+ *              (WaterTreatmentSystem.txt) once its CRC is in place.
+ *
+ *              The .fwz written is each block's struct comms_fw_upgrade_z
+ *              in turn, (7 byte header then zlen bytes), in address order,
+ *              which is the order they must be sent in.
+ *
+ *              Usage: wts_fwpack image [out.fwz]
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fw_image.h"
+#include "crc_api.h"
+
+#define FWPACK_FRAMING      (8)         /* STX, header, CRC and ETX.      */
+#define FWPACK_RAW_BLOCK    (128)
+
+int main(int argc, char *argv[])
+{
+    static uint8_t image[FW_IMAGE_SIZE];
+    struct fwz_block blk[FWZ_SEG_BLOCKS];
+    uint8_t payload[CCP_PAYLOAD_MAX];
+    unsigned long raw = 0, packed = 0, blocks = 0;
+    FILE *out = NULL;
+    int seg, i, n, size;
+
+    if(argc < 2 || argc > 3){
+        fprintf(stderr, "usage: wts_fwpack image [out.fwz]\n");
+        return 2;
+    }
+    if(fw_image_load(argv[1], image)){
+        return 1;
+    }
+    if(gsebus_crc_isInvalid(image, FW_IMAGE_SIZE - 2)){
+        fprintf(stderr, "wts_fwpack: warning, %s has no CRC in place, "
+                        "the WTS will not reflash it\n", argv[1]);
+    }
+    if(argc == 3 && (out = fopen(argv[2], "wb")) == NULL){
+        perror(argv[2]);
+        return 1;
+    }
+
+    printf("seg  addr   blocks  bytes\n");
+    for(seg = 0; seg < WTS_FW_SEGS; seg++){
+        unsigned long seg_bytes = 0;
+
+        n = fwz_pack_seg(image, seg, blk);
+        for(i = 0; i < n; i++){
+            size = fwz_block_form(&blk[i], payload);
+            seg_bytes += size + FWPACK_FRAMING;
+            if(out != NULL &&
+               fwrite(&payload[1], 1, size - 1, out) != (size_t)size - 1){
+                perror(argv[2]);
+                return 1;
+            }
+        }
+        printf("%3d  %04X   %3d     %5lu\n", seg,
+               FW_IMAGE_ORIGIN + seg * WTS_FW_SEG_SIZE, n, seg_bytes);
+        packed += seg_bytes;
+        blocks += n;
+    }
+    raw = (unsigned long)FW_IMAGE_SIZE / FWPACK_RAW_BLOCK *
+          (1 + 3 + FWPACK_RAW_BLOCK + FWPACK_FRAMING);
+    printf("wts_fwpack: %lu blocks, %lu bytes on the bus, %lu as plain "
+           "blocks (%.0f%%)\n", blocks, packed, raw, 100.0 * packed / raw);
+    if(out != NULL && fclose(out) != 0){
+        perror(argv[2]);
+        return 1;
+    }
+    return 0;
+}
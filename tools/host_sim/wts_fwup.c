@@ -0,0 +1,406 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    wts_fwup.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Firmware upgrade from Linux, sending only the flash
+ *              segments that differ.
+ *
+ *              The CRC of each segment of the new .fwi image is compared
+ *              with those of the WTS's new copy of the code (0xC000, see
+ *              WTS_DADR_FW_SEG_CRC).  Only segments that differ are sent,
+ *              in WTS_DADR_FW_BLOCK blocks, then the CRCs are checked again
+ *              and the WTS told to reflash.  Normally the new copy still
+ *              holds the last release, so only what changed since then
+ *              goes over the bus.
+ *
+ *              If the WTS stops answering part way, wts_fwup waits for it
+ *              and carries on from where WTS_DADR_FW_SEG_MAP says it got
+ *              to, rather than starting again.
+ *
+ *              With -z the segments go as compressed WTS_DADR_FW_BLOCK_Z
+ *              blocks, (see wts_fwpack).
+ *
+ *              Usage: wts_fwup [options] image link
+ *                  image     .fwi, or TI-TXT with the CRC in place.
+ *                  -a        Send all segments, (no delta).
+ *                  -z        Send compressed blocks.
+ *                  -n        Do not reflash, just load the new copy.
+ *                  -w ms     Response timeout (default 500).
+ *                  -r s      Time to wait for the WTS to come back, if it
+ *                            stops answering (default 60).
+ *                  -b baud   Set the serial device baud rate.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ccp_link.h"
+#include "fw_image.h"
+#include "gsebus.h"
+#include "wts_comms.h"
+#include "crc_api.h"
+
+#define FWUP_BLOCK          (128)       /* Data bytes per raw block.      */
+#define FWUP_SEG_BLOCKS     (WTS_FW_SEG_SIZE / FWUP_BLOCK)
+#define FWUP_TRIES          (5)         /* Attempts at each transaction.  */
+
+#if FWZ_SEG_BLOCKS > FWUP_SEG_BLOCKS
+#error "Room for FWUP_SEG_BLOCKS blocks per segment."
+#endif
+
+/*-- A block of firmware, ready to go. */
+struct fwup_block {
+    uint16_t addr;
+    uint8_t  size;
+    uint8_t  req[CCP_PAYLOAD_MAX];
+};
+
+static int link_fd;
+static double timeout = 0.5;
+static double resume_wait = 60;
+static unsigned long blocks_sent, bytes_sent;
+static struct fwup_block blocks[WTS_FW_SEGS][FWUP_SEG_BLOCKS];
+static int seg_blocks[WTS_FW_SEGS];
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          seg_crc_read
+ *  FUNCTIONAL DESCRIPTION: Read the CRC of each segment of both copies of
+ *                          the code on the WTS.
+ *  FORMAL PARAMETERS:      running : WTS_FW_SEGS CRCs of the running code.
+ *                          staging : WTS_FW_SEGS CRCs of the new copy.
+ *  RETURN VALUE:           Z if OK.
+ ******************************************************************************
+ */
+static int seg_crc_read(uint16_t *running, uint16_t *staging)
+{
+    const uint8_t loc = WTS_DADR_FW_SEG_CRC;
+    uint8_t resp[CCP_PAYLOAD_MAX];
+    uint8_t size;
+    int i, tries;
+
+    for(tries = 0; tries < FWUP_TRIES; tries++){
+        if(ccp_transact(link_fd, WTS_CMD_RD_DATA, &loc, 1, resp, &size,
+                        timeout) != CCP_ACK ||
+           size != 1 + 4 * WTS_FW_SEGS || resp[0] != loc){
+            ccp_link_resync(link_fd);   /* (Reply to something else?)     */
+        } else {
+            for(i = 0; i < WTS_FW_SEGS; i++){
+                running[i] = resp[1 + 2 * i] | resp[2 + 2 * i] << 8;
+                staging[i] = resp[1 + 2 * (i + WTS_FW_SEGS)] |
+                             resp[2 + 2 * (i + WTS_FW_SEGS)] << 8;
+            }
+            return 0;
+        }
+    }
+    fprintf(stderr, "wts_fwup: no segment CRCs from the WTS, "
+                    "(firmware too old?)\n");
+    return 1;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          blocks_form
+ *  FUNCTIONAL DESCRIPTION: Split the image into the blocks to send.
+ *  FORMAL PARAMETERS:      image : Whole image.
+ *                          z     : NZ for compressed blocks.
+ ******************************************************************************
+ */
+static void blocks_form(const uint8_t *image, int z)
+{
+    struct fwz_block zblk[FWZ_SEG_BLOCKS];
+    int seg, i;
+
+    for(seg = 0; seg < WTS_FW_SEGS; seg++){
+        if(z){
+            seg_blocks[seg] = fwz_pack_seg(image, seg, zblk);
+            for(i = 0; i < seg_blocks[seg]; i++){
+                blocks[seg][i].addr = zblk[i].addr;
+                blocks[seg][i].size = fwz_block_form(&zblk[i],
+                                                     blocks[seg][i].req);
+            }
+            continue;
+        }
+        seg_blocks[seg] = FWUP_SEG_BLOCKS;
+        for(i = 0; i < FWUP_SEG_BLOCKS; i++){
+            struct fwup_block *b = &blocks[seg][i];
+            int offset = seg * WTS_FW_SEG_SIZE + i * FWUP_BLOCK;
+            b->addr   = FW_IMAGE_ORIGIN + offset;
+            b->req[0] = WTS_DADR_FW_BLOCK;
+            b->req[1] = b->addr;        /* struct comms_fw_upgrade.       */
+            b->req[2] = b->addr >> 8;
+            b->req[3] = FWUP_BLOCK;
+            memcpy(&b->req[4], &image[offset], FWUP_BLOCK);
+            b->size   = 4 + FWUP_BLOCK;
+        }
+    }
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          block_send
+ *  FUNCTIONAL DESCRIPTION: Write one block of the new copy.
+ *  FORMAL PARAMETERS:      b    : Block.
+ *                          fail : Where to put the address of an earlier
+ *                                 block the WTS says failed to verify.
+ *  RETURN VALUE:           0 if accepted, WTS_ERR_xxx or -1 if no answer.
+ ******************************************************************************
+ */
+static int block_send(const struct fwup_block *b, uint16_t *fail)
+{
+    uint8_t resp[CCP_PAYLOAD_MAX];
+    uint8_t size;
+    int tries;
+
+    for(tries = 0; tries < FWUP_TRIES; tries++){
+        bytes_sent += b->size + 8;      /* (Framing, STX to ETX.)         */
+        if(ccp_transact(link_fd, WTS_CMD_WR_DATA, b->req, b->size,
+                        resp, &size, timeout) != CCP_ACK ||
+           size < 2 || resp[0] != b->req[0]){
+            ccp_link_resync(link_fd);
+            continue;                   /* (Resend is harmless.)          */
+        }
+        blocks_sent++;
+        if(resp[1] == WTS_ERR_FWUG_BUSY){
+            usleep(10000);
+            continue;
+        }
+        if(resp[1] == WTS_ERR_FWUG_WRFAIL && size >= 4){
+            *fail = resp[2] | resp[3] << 8;
+        }
+        return resp[1];
+    }
+    return -1;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          seg_send
+ *  FUNCTIONAL DESCRIPTION: Write one segment of the new copy, normally
+ *                          starting at its first block so the WTS erases it.
+ *  FORMAL PARAMETERS:      seg    : Segment.
+ *                          first  : Block of it to start at.
+ *                          fail   : As block_send.
+ *  RETURN VALUE:           As block_send.
+ ******************************************************************************
+ */
+static int seg_send(int seg, int first, uint16_t *fail)
+{
+    int err, i;
+
+    for(i = first; i < seg_blocks[seg]; i++){
+        err = block_send(&blocks[seg][i], fail);
+        if(err != 0){
+            return err;
+        }
+    }
+    return 0;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          resume_point
+ *  FUNCTIONAL DESCRIPTION: Wait for the WTS to answer again, then find
+ *                          where to carry on from.
+ *  FORMAL PARAMETERS:      seg    : Segment being sent, updated to the
+ *                                   one to carry on with.
+ *                          first  : Block of it to carry on with.
+ *  RETURN VALUE:           Z if OK, NZ if the WTS never came back.
+ ******************************************************************************
+ */
+static int resume_point(int *seg, int *first)
+{
+    const uint8_t loc = WTS_DADR_FW_SEG_MAP;
+    double give_up = ccp_now() + resume_wait;
+    uint8_t resp[CCP_PAYLOAD_MAX];
+    uint8_t size;
+    uint16_t map, fill;
+    int i;
+
+    fprintf(stderr, "wts_fwup: WTS stopped answering, waiting\n");
+    while(ccp_transact(link_fd, WTS_CMD_RD_DATA, &loc, 1, resp, &size,
+                       timeout) != CCP_ACK || size < 5 || resp[0] != loc){
+        if(ccp_now() > give_up){
+            return 1;
+        }
+        usleep(100000);
+    }
+    map  = resp[1] | resp[2] << 8;
+    fill = resp[3] | resp[4] << 8;
+
+    *first = 0;
+    if(map & (1 << *seg)){              /* Got all of it after all.       */
+        (*seg)++;
+    } else {
+        for(i = 1; i < seg_blocks[*seg]; i++){
+            if(blocks[*seg][i].addr == fill){
+                *first = i;             /* Got this far in order.         */
+            }
+        }
+    }
+    fprintf(stderr, "wts_fwup: carrying on at %04X\n",
+            *seg < WTS_FW_SEGS? blocks[*seg][*first].addr: fill);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t image[FW_IMAGE_SIZE];
+    uint16_t running[WTS_FW_SEGS], staging[WTS_FW_SEGS], crc[WTS_FW_SEGS];
+    uint8_t send[WTS_FW_SEGS];
+    int all = 0, z = 0, no_reflash = 0, baud = 0, changed = 0, same = 1;
+    int opt, seg, first, err;
+    double t0;
+
+    while((opt = getopt(argc, argv, "aznw:r:b:")) != -1){
+        switch(opt){
+            case 'a': all        = 1;                     break;
+            case 'z': z          = 1;                     break;
+            case 'n': no_reflash = 1;                     break;
+            case 'w': timeout    = atof(optarg) / 1000;   break;
+            case 'r': resume_wait = atof(optarg);         break;
+            case 'b': baud       = atoi(optarg);          break;
+            default:
+                optind = argc;
+                break;
+        }
+    }
+    if(optind != argc - 2){
+        fprintf(stderr, "usage: wts_fwup [-a] [-z] [-n] [-w ms] [-r s] "
+                        "[-b baud] image link\n");
+        return 2;
+    }
+
+    /*-- The whole 8K image, its CRC already in place. */
+    if(fw_image_load(argv[optind], image)){
+        return 1;
+    }
+    if(gsebus_crc_isInvalid(image, FW_IMAGE_SIZE - 2)){
+        fprintf(stderr, "wts_fwup: %s has a bad CRC\n", argv[optind]);
+        return 1;
+    }
+    blocks_form(image, z);
+
+    link_fd = ccp_link_open(argv[optind + 1], baud);
+    t0 = ccp_now();
+    if(seg_crc_read(running, staging)){
+        return 1;
+    }
+
+    /*-- Work out what to send. */
+    printf("seg  addr   image  new copy  running\n");
+    for(seg = 0; seg < WTS_FW_SEGS; seg++){
+        crc[seg]  = gsebus_crc_calc(&image[seg * WTS_FW_SEG_SIZE],
+                                    WTS_FW_SEG_SIZE);
+        send[seg] = all || crc[seg] != staging[seg];
+        changed  += send[seg];
+        same     &= crc[seg] == running[seg];
+        printf("%3d  %04X   %04X   %04X      %04X     %s\n", seg,
+               FW_IMAGE_ORIGIN + seg * WTS_FW_SEG_SIZE, crc[seg], staging[seg],
+               running[seg], send[seg]? "send": "");
+    }
+    if(same && !all){
+        printf("wts_fwup: WTS is already running this image\n");
+        return 0;
+    }
+    printf("wts_fwup: sending %d of %d segments\n", changed, WTS_FW_SEGS);
+
+    /*-- Send them.  A block that fails to verify is only reported on the */
+    /*   next block, so start again at the segment it was in.             */
+    seg   = 0;
+    first = 0;
+    while(seg < WTS_FW_SEGS){
+        uint16_t fail = 0;
+        if(!send[seg]){
+            seg++;
+            continue;
+        }
+        err = seg_send(seg, first, &fail);
+        first = 0;
+        if(err == WTS_ERR_FWUG_WRFAIL && fail >= FW_IMAGE_ORIGIN &&
+           fail < FW_IMAGE_ORIGIN + FW_IMAGE_SIZE){
+            fprintf(stderr, "wts_fwup: block at %04X failed, resending\n",
+                    fail);
+            seg = (fail - FW_IMAGE_ORIGIN) / WTS_FW_SEG_SIZE;
+            continue;
+        }
+        if(err < 0){                    /* Lost the WTS?                  */
+            if(resume_point(&seg, &first)){
+                fprintf(stderr, "wts_fwup: WTS did not come back\n");
+                return 1;
+            }
+            continue;
+        }
+        if(err != 0){
+            fprintf(stderr, "wts_fwup: segment %d not accepted (%d)\n",
+                    seg, err);
+            return 1;
+        }
+        seg++;
+    }
+
+    /*-- Check it all landed, (this also waits for the last block). */
+    if(seg_crc_read(running, staging)){
+        return 1;
+    }
+    for(seg = 0; seg < WTS_FW_SEGS; seg++){
+        if(staging[seg] != crc[seg]){
+            fprintf(stderr, "wts_fwup: segment %d did not load\n", seg);
+            return 1;
+        }
+    }
+    printf("wts_fwup: %lu blocks, %lu bytes in %.2f s\n", blocks_sent,
+           bytes_sent, ccp_now() - t0);
+    if(no_reflash){
+        return 0;
+    }
+
+    /*-- The WTS reflashes and restarts without a reply, unless the new */
+    /*   copy's CRC is bad.                                              */
+    {
+        const uint8_t req = WTS_DADR_REFLASH;
+        uint8_t resp[CCP_PAYLOAD_MAX];
+        uint8_t size;
+
+        if(ccp_transact(link_fd, WTS_CMD_WR_DATA, &req, 1, resp, &size,
+                        timeout) == CCP_ACK && size >= 2 && resp[1] != 0){
+            fprintf(stderr, "wts_fwup: reflash refused (%d)\n", resp[1]);
+            return 1;
+        }
+    }
+    printf("wts_fwup: reflashing\n");
+
+    /*-- Once restarted, the WTS says how many segments it rewrote. */
+    {
+        const uint8_t req = WTS_DADR_REFLASH;
+        double give_up = ccp_now() + resume_wait;
+        uint8_t resp[CCP_PAYLOAD_MAX];
+        uint8_t size;
+
+        usleep(500000);
+        while(ccp_now() < give_up){
+            enum ccp_result res = ccp_transact(link_fd, WTS_CMD_RD_DATA,
+                                               &req, 1, resp, &size, timeout);
+            if(res == CCP_ACK && size >= 2 && resp[0] == req){
+                printf("wts_fwup: WTS restarted, %d segments rewritten\n",
+                       resp[1]);
+                return 0;
+            }
+            if(res == CCP_NACK){        /* (Older firmware.)              */
+                printf("wts_fwup: WTS restarted\n");
+                return 0;
+            }
+            usleep(100000);
+        }
+    }
+    fprintf(stderr, "wts_fwup: WTS did not come back\n");
+    return 1;
+}
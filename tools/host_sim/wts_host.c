@@ -0,0 +1,211 @@
+/*
+ ******************************************************************************
+ *
+ *  FILE:    wts_host.c  (host simulation)
+ *
+ *  DATE:    17/10/2026
+ *
+ *  DESCRIPTION: Runs the simulated WTS in real time with its GSEBUS serial
+ *              port on a pseudo terminal, or a TCP socket, so a CCP stand
+ *              in (ccp_bench) or the real CCP software can talk to it.
+ *
+ *              Characters are timed by the simulated USART at whatever
+ *              baud rate the firmware has set, so link timing is as it
+ *              would be on the RS485 bus.
+ *
+ *              Usage: wts_host [-t port] [-x speed]
+ *                  -t port   Listen on TCP port (localhost) instead of a
+ *                            pseudo terminal.
+ *                  -x speed  Simulated time per real time, (default 1).
+ *
+ *              SIGUSR1 breaks the link, and SIGUSR2 mends it, to try out
+ *              the CCP end's recovery.  While broken, chars both ways are
+ *              lost, as they would be on the bus.
+ *
+ *  COPYRIGHT:  Ceramic Fuel Cells Limited 2026
+ *
+ ******************************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "io430.h"
+#include "sim.h"
+
+#define HOST_SLICE_CYCLES   (800)       /* 100us between link polls.      */
+
+static int link_fd = -1;                /* GSEBUS link, -1 if none.       */
+static int listen_fd = -1;              /* TCP listen socket.             */
+static volatile sig_atomic_t link_broken;
+
+static void link_break(int sig)
+{
+    link_broken = (sig == SIGUSR1);
+}
+
+/*-- WTS has sent a char, pass it straight on. */
+static void host_uart_tx(uint8_t ch, uint64_t cycle)
+{
+    (void)cycle;
+    if(link_broken){
+        return;
+    }
+    if(link_fd >= 0 && write(link_fd, &ch, 1) != 1 && errno != EAGAIN &&
+       listen_fd >= 0){
+        close(link_fd);                 /* CCP went away.                 */
+        link_fd = -1;
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          open_pty
+ *  FUNCTIONAL DESCRIPTION: Open a raw pseudo terminal, and say where it is.
+ *  RETURN VALUE:           Master side fd.
+ ******************************************************************************
+ */
+static int open_pty(void)
+{
+    struct termios tio;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+
+    if(fd < 0 || grantpt(fd) || unlockpt(fd) || tcgetattr(fd, &tio)){
+        perror("wts_host: pty");
+        exit(1);
+    }
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+
+    /*-- Hold the slave side open too, so the link does not hang up each */
+    /*   time the CCP end closes it.                                      */
+    if(open(ptsname(fd), O_RDWR | O_NOCTTY) < 0){
+        perror("wts_host: pty");
+        exit(1);
+    }
+    printf("wts_host: GSEBUS on %s\n", ptsname(fd));
+    return fd;
+}
+
+/*
+ ******************************************************************************
+ *  FUNCTION NAME:          open_listen
+ *  FUNCTIONAL DESCRIPTION: Listen for a TCP connection on localhost.
+ *  RETURN VALUE:           Listen socket fd.
+ ******************************************************************************
+ */
+static int open_listen(int port)
+{
+    struct sockaddr_in sa;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons(port);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if(fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) ||
+       listen(fd, 1)){
+        perror("wts_host: listen");
+        exit(1);
+    }
+    printf("wts_host: GSEBUS on tcp port %d\n", port);
+    return fd;
+}
+
+/*-- Take in anything the CCP has sent, waiting up to timeout seconds. */
+static void link_poll(double timeout)
+{
+    struct pollfd pfd;
+    struct timespec ts;
+    uint8_t buf[256];
+    ssize_t n;
+
+    if(link_fd < 0 && listen_fd >= 0){  /* Waiting for a connection?      */
+        int one = 1;
+        link_fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if(link_fd >= 0){
+            setsockopt(link_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+    }
+    pfd.fd     = (link_fd >= 0)? link_fd: listen_fd;
+    pfd.events = POLLIN;
+    if(timeout < 0){
+        timeout = 0;
+    }
+    ts.tv_sec  = (time_t)timeout;
+    ts.tv_nsec = (long)((timeout - ts.tv_sec) * 1e9);
+    if(pfd.fd < 0 || ppoll(&pfd, 1, &ts, NULL) <= 0 || link_fd < 0){
+        return;
+    }
+    n = read(link_fd, buf, sizeof(buf));
+    if(n > 0 && !link_broken){
+        sim_uart_rx(buf, n);
+    } else if(n == 0 && listen_fd >= 0){
+        close(link_fd);                 /* CCP went away.                 */
+        link_fd = -1;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    double speed = 1.0;
+    double t0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "t:x:")) != -1){
+        switch(opt){
+            case 't': listen_fd = open_listen(atoi(optarg)); break;
+            case 'x': speed = atof(optarg);                  break;
+            default:
+                fprintf(stderr, "usage: wts_host [-t port] [-x speed]\n");
+                return 2;
+        }
+    }
+    if(listen_fd < 0){
+        link_fd = open_pty();
+    }
+    fflush(stdout);
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGUSR1, link_break);
+    signal(SIGUSR2, link_break);
+
+    sim_uart_tx = host_uart_tx;
+    sim_init();
+    t0 = now();
+
+    for(;;){
+        uint64_t end = sim_cycles + HOST_SLICE_CYCLES;
+        double ahead;
+
+        while(sim_cycles < end){
+            sim_main_loop();
+        }
+
+        /*-- Keep simulated time with real time, polling the link. */
+        ahead = (double)sim_cycles / SIM_SMCLK_HZ / speed - (now() - t0);
+        link_poll(ahead);
+        if(ahead < -1.0){
+            t0 += -1.0 - ahead;         /* Too far behind, stop chasing.  */
+        }
+    }
+}
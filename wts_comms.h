@@ -25,6 +25,21 @@
 #define WTS_CMD_WR_DATA      (0x08)  /* Write data to location.      */
 #define WTS_CMD_RD_DATA      (0x09)  /* Read data from location.     */
 #define WTS_CMD_WR_RD_DATA   (0x0A)  /* Write then read location     */
+#define WTS_CMD_MULTI        (0x0B)  /* Batch of the above commands. */
+
+/*--- WTS_CMD_MULTI payload is a list of items, each being:
+ *        Command         WTS_CMD_WR_DATA, _RD_DATA or _WR_RD_DATA
+ *        Length          Number of bytes that follow (at least 1).
+ *        Location ID     Then any data to write, as for single command.
+ *     The items are carried out in order.  The ACK response holds an item
+ *     for each one carried out:
+ *        ACK or NACK     As for single command.
+ *        Length          Number of bytes that follow.
+ *        Data            Payload of the single command response.
+ *     Items are left off the end of the response when it is full, so the
+ *     CCP should resend those.  A badly formed list is NACKed, and then
+ *     none of it is carried out.  An item whose length is not what its
+ *     location takes is NACKed on its own, as is a single command.     */
 
 /*--  These "location ID's" are used with the read, write and 
  *     read write commands                                      */
@@ -36,7 +51,95 @@
 /*--- Location identifiers made up specifically for WTS comms.      */
 #define WTS_DADR_CTRL_STATUS    (0x10)  /* Control / status "location"  */
 #define WTS_DADR_FW_BLOCK       (0x11)  /* Write one "block" of firmware*/
+                                        /* (Acked once accepted, then   */
+                                        /* written in the background.   */
+                                        /* The next block's reply has   */
+                                        /* WTS_ERR_FWUG_WRFAIL and the  */
+                                        /* failed block's address if it */
+                                        /* did not verify.)             */
 #define WTS_DADR_REFLASH        (0x12)  /* Re-write code flash.     */
+                                        /* (Read gives the segments the */
+                                        /* last reflash rewrote, or     */
+                                        /* WTS_REFLASH_NONE, then the   */
+                                        /* WTS_BOOT_xxx flags.)         */
+#define WTS_DADR_BAUD_RATE      (0x13)  /* Serial baud rate select. */
+#define WTS_DADR_STATUS_DELTA   (0x14)  /* Status, changed fields only. */
+#define WTS_DADR_ANIN_CAPTURE   (0x15)  /* Raw ADC waveform capture.    */
+#define WTS_DADR_ISR_LATENCY    (0x16)  /* Worst Timer A ISR latencies. */
+                                        /* (uint16_t SMCLK cycles for   */
+                                        /* CCR0, 1, 2, write clears.    */
+                                        /* TIMER_LAT_ENABLE builds only,*/
+                                        /* else NACKed.)                */
+#define WTS_DADR_FW_SEG_CRC     (0x17)  /* CRC of each flash segment.   */
+#define WTS_DADR_FW_SEG_MAP     (0x18)  /* New copy segments loaded.    */
+#define WTS_DADR_FW_BLOCK_Z     (0x19)  /* Write a compressed "block".  */
+                                        /* (Replies as for FW_BLOCK.)   */
+#define WTS_DADR_STATUS_EU      (0x1A)  /* Status in engineering units. */
+#define WTS_DADR_ANIN_CAL       (0x1B)  /* Analogue input calibration.  */
+
+/*--- WTS_DADR_FW_SEG_CRC, (read only).
+ *     Response:      Location ID, then a uint16_t CRC for each of the
+ *                    WTS_FW_SEGS segments of the running code (0xE000 up),
+ *                    then each segment of the new copy (0xC000 up).
+ *     The CRC is that of the GSEBUS, over the WTS_FW_SEG_SIZE bytes.
+ *     Segment n of a .fwi image goes to 0xC000 + n * WTS_FW_SEG_SIZE, so
+ *     only segments whose CRC differs from the new copy's need sending. */
+#define WTS_FW_NEW_COPY         (0xC000)
+#define WTS_FW_SEG_SIZE         (512)
+#define WTS_FW_SEGS             (16)
+
+#define WTS_REFLASH_NONE        (0xFF)  /* No reflash before last reset. */
+
+/*--- WTS_DADR_REFLASH read, how the code flash was checked at start up.
+ *     A start up that finds a boot record for the running code (INFOB)
+ *     skips its full CRC, that and the new copy's CRC being done once
+ *     running instead.  The new copy is rewritten from the running code
+ *     if bad, unless a download has started.                           */
+#define WTS_BOOT_CACHED         (0x01)  /* Start up trusted boot record. */
+#define WTS_BOOT_MAIN_OK        (0x02)  /* Running code CRC good.        */
+#define WTS_BOOT_COPY_OK        (0x04)  /* New copy CRC good.            */
+#define WTS_BOOT_COPY_FIXED     (0x08)  /* New copy rewritten.           */
+#define WTS_BOOT_DONE           (0x80)  /* Checks finished.              */
+
+/*--- WTS_DADR_FW_SEG_MAP, (read only).
+ *     Response:      Location ID,
+ *                    uint16_t bitmap, bit n set if segment n of the new
+ *                    copy has been written from its start and verified,
+ *                    uint16_t address the segment being written has got
+ *                    to, 0 if none.
+ *     So an interrupted download can carry on where it stopped.  Only
+ *     blocks written since the WTS started count, after a reset use
+ *     WTS_DADR_FW_SEG_CRC instead.                                     */
+
+/*--- WTS_DADR_FW_BLOCK_Z, (write only).
+ *     Request:       Location ID, struct comms_fw_upgrade_z.
+ *     As WTS_DADR_FW_BLOCK, but the data is compressed and is expanded
+ *     straight into flash as it is written.  The len bytes it expands to
+ *     must be within one segment, and crc is their GSEBUS CRC, checked
+ *     once written.  The data is a list of tokens, a control byte c then
+ *       c < WTS_FWZ_SHORT  c + 1 literal bytes,
+ *       c < WTS_FWZ_LONG   uint8_t d, copy (c & WTS_FWZ_LEN_MASK) +
+ *                          WTS_FWZ_SHORT_MIN bytes from d + 1 back,
+ *       otherwise          uint16_t d, copy (c & WTS_FWZ_LEN_MASK) +
+ *                          WTS_FWZ_LONG_MIN bytes from d + 1 back.
+ *     A copy may overlap what it produces (a run), or reach back before
+ *     the block into the new copy, which must then hold what the image
+ *     has there, (i.e. blocks go in address order).                    */
+#define WTS_FWZ_SHORT           (0x80)
+#define WTS_FWZ_LONG            (0xC0)
+#define WTS_FWZ_LEN_MASK        (0x3F)
+#define WTS_FWZ_SHORT_MIN       (3)
+#define WTS_FWZ_LONG_MIN        (4)
+
+/*--- Baud rate codes used with WTS_DADR_BAUD_RATE.                 */
+/*    A new rate takes effect once the acknowledgement has been sent */
+/*    and must be confirmed by a good packet at the new rate, else   */
+/*    the WTS drops back to WTS_BAUD_DEFAULT.                        */
+#define WTS_BAUD_57600          (0)
+#define WTS_BAUD_115200         (1)
+#define WTS_BAUD_230400         (2)
+#define WTS_BAUD_RATES          (3)     /* Number of supported rates.   */
+#define WTS_BAUD_DEFAULT        WTS_BAUD_57600
 
 struct comms_wts_ctrl_bits {
     uint16_t DeminFillValve:1;
@@ -66,11 +169,90 @@ struct comms_fw_upgrade{
     uint8_t  data[256-4-3];     /* 128 bytes of firmware.   */
 };
 
+struct comms_fw_upgrade_z{
+    uint16_t addr;              /* Data destination.        */
+    uint16_t len;               /* Length once expanded.    */
+    uint16_t crc;               /* CRC once expanded.       */
+    uint8_t  zlen;              /* Length of data.          */
+    uint8_t  data[256-4-7];     /* Compressed firmware.     */
+};
+
+/*--- WTS_DADR_ANIN_CAPTURE.
+ *     Write request: Location ID, WTS_CAP_xxx action, then for
+ *                    WTS_CAP_ARM a struct comms_anin_cap_cfg.
+ *     Write response: Location ID, status.
+ *     Read request:  Location ID, uint16_t offset (in samples).
+ *     Read response: Location ID, WTS_CAP_STATE_xxx, channel mask,
+ *                    uint16_t samples captured, uint16_t offset of first
+ *                    sample after the trigger, uint16_t sequence count of
+ *                    first sample set, uint16_t offset, then up to
+ *                    WTS_CAP_CHUNK uint16_t samples from offset.
+ *     Samples are only given once the capture is done.  Each 1600Hz
+ *     sample set holds the selected ADC12MEMx (see anin.h) in order.
+ *     The sequence count gives the mux channel (count % 8) and probe
+ *     phase (count % 4) of each set.                                    */
+#define WTS_CAP_STOP            (0)     /* Actions.                     */
+#define WTS_CAP_ARM             (1)
+#define WTS_CAP_TRIGGER         (2)     /* Trigger now.                 */
+
+#define WTS_CAP_TRIG_CMD        (0)     /* Only on WTS_CAP_TRIGGER.     */
+#define WTS_CAP_TRIG_RISING     (1)     /* Channel goes up past level.  */
+#define WTS_CAP_TRIG_FALLING    (2)     /* Channel goes down past level.*/
+
+#define WTS_CAP_STATE_IDLE      (0)
+#define WTS_CAP_STATE_ARMED     (1)     /* Waiting for trigger.         */
+#define WTS_CAP_STATE_TRIGGERED (2)     /* Taking post trigger samples. */
+#define WTS_CAP_STATE_DONE      (3)     /* Samples ready to read.       */
+
+#define WTS_CAP_CHUNK           (96)    /* Max samples per read.        */
+
+/*--- WTS_DADR_ANIN_CAL.
+ *     Write request:  Location ID, struct comms_anin_cal.
+ *     Write response: Location ID, status.
+ *     Read request:   Location ID.
+ *     Read response:  Location ID, WTS_CAL_xxx, struct comms_anin_cal in
+ *                     use.
+ *     A write is kept in INFOA flash, CRC protected, and used at once.
+ *     One with an offset beyond +/-WTS_CAL_OFFSET_MAX is refused with
+ *     WTS_ERR_CAL_RANGE, (gains are 0 to just under 2, any value).
+ *     Channels are ADC12MEM0-7 (see anin.h) then mux channels 0-7.  Each
+ *     filtered reading becomes (reading - offset) * gain / WTS_CAL_GAIN_ONE,
+ *     before it goes in the status, raw or engineering units.  With no
+ *     good record offsets are 0 and gains WTS_CAL_GAIN_ONE.             */
+#define WTS_CAL_CHANNELS        (16)
+#define WTS_CAL_GAIN_ONE        (0x8000)
+#define WTS_CAL_OFFSET_MAX      (2047)  /* Half the ADC range.          */
+
+#define WTS_CAL_NONE            (0)     /* Defaults in use.             */
+#define WTS_CAL_STORED          (1)     /* From INFOA.                  */
+
+struct comms_anin_cal_chan{
+    int16_t  offset;            /* Filtered ADC counts.                 */
+    uint16_t gain;              /* WTS_CAL_GAIN_ONE is 1.               */
+};
+
+struct comms_anin_cal{
+    struct comms_anin_cal_chan chan[WTS_CAL_CHANNELS];
+};
+
+struct comms_anin_cap_cfg{
+    uint16_t chan_mask;         /* Bit n set to capture ADC12MEMn.      */
+    uint16_t post_sets;         /* Sample sets to keep after trigger.   */
+    uint16_t trig_level;        /* Raw ADC count.                       */
+    uint8_t  trig_chan;         /* ADC12MEMn to trigger on.             */
+    uint8_t  trig_mode;         /* WTS_CAP_TRIG_xxx.                    */
+};
+
 #define WTS_ERR_BASE            (20)
 
 #define WTS_ERR_FWUG_BADADDR (1 + WTS_ERR_BASE) /* Unacceptable address  */
 #define WTS_ERR_FWUG_WRFAIL  (2 + WTS_ERR_BASE) /* Write verification fail.*/
 #define WTS_ERR_FWUG_CRC     (3 + WTS_ERR_BASE) /* Bad CRC on reflash command*/
+#define WTS_ERR_BAUD_RATE    (4 + WTS_ERR_BASE) /* Unsupported baud rate.   */
+#define WTS_ERR_CAP_CFG      (5 + WTS_ERR_BASE) /* Bad capture set up.      */
+#define WTS_ERR_FWUG_BUSY    (6 + WTS_ERR_BASE) /* Last block still going.  */
+#define WTS_ERR_CAL_WRFAIL   (7 + WTS_ERR_BASE) /* Calibration not stored.  */
+#define WTS_ERR_CAL_RANGE    (8 + WTS_ERR_BASE) /* Calibration out of range.*/
 
 struct comms_wts_status_bits {
     uint16_t TankHigh:1;
@@ -86,6 +268,22 @@ struct comms_wts_status_bits {
     uint16_t spares:6;
 };
 
+/*--- WTS_DADR_STATUS_DELTA.
+ *     Read request:  Location ID, Seq of last response received (0: none).
+ *     Read / write request as above followed by struct comms_wts_ctrl.
+ *     Response:      Location ID, Seq of this response,
+ *                    Seq of response it is relative to (0: full snapshot),
+ *                    Bitmap of fields that follow (WTS_STATUS_BITMAP_SIZE),
+ *                    Fields with a bit set, in order.
+ *     Fields are those of struct comms_wts_status in order, bit 0 of the
+ *     first bitmap byte being sw_version, port_raw_inputs counting as one
+ *     field.  A field is only sent when it differs (by more than its
+ *     deadband) from the response the CCP said it has; other fields keep
+ *     the value they had in that response.  Asking with a seq of 0, or one
+ *     the WTS does not know, gets a full snapshot.                       */
+#define WTS_STATUS_FIELDS       (25)
+#define WTS_STATUS_BITMAP_SIZE  ((WTS_STATUS_FIELDS + 7) / 8)
+
 struct comms_wts_status{
     uint16_t sw_version;
     uint16_t UpTimeTick;
@@ -102,9 +300,9 @@ struct comms_wts_status{
                                         /* analogue input filtering.        */
     uint16_t cool_air_pos_estimate;
 
-    uint16_t anin_probe1_conductivity;
+    uint16_t anin_probe1_conductivity;  /* Excited less not, (anin.c).  */
     uint16_t anin_probe1_temperature;
-    uint16_t anin_probe2_conductivity;
+    uint16_t anin_probe2_conductivity;  /* Excited less not, (anin.c).  */
     uint16_t anin_probe2_temperature;
     uint16_t anin_spare1;               /* (Spare input)    */
     uint16_t anin_water_meter;          /* (Spare input)    */
@@ -121,4 +319,34 @@ struct comms_wts_status{
     uint16_t anin_boost_current;        /* Pump                     */
 };
 
+/*--- WTS_DADR_STATUS_EU.
+ *     Read request:  Location ID.
+ *     Read response: Location ID, WTS_EU_xxx flags,
+ *                    struct comms_wts_status_eu.
+ *     The probe, supply and current readings of struct comms_wts_status
+ *     in engineering units, from the same filtered readings.  Each
+ *     probe's conductivity is compensated to 25 degC (2%/degC) with its
+ *     own temperature.
+ *     While WTS_EU_UNCONFIRMED is set the conversions are for assumed
+ *     front ends (see anin.c), not yet checked against the board
+ *     schematics, so the values are uncalibrated and only good for
+ *     trends.  Use struct comms_wts_status for anything that matters.   */
+#define WTS_EU_UNCONFIRMED      (0x01)  /* Conversions not yet checked. */
+
+struct comms_wts_status_eu{
+    int16_t  probe1_temperature;        /* 0.01 degC.               */
+    uint16_t probe1_conductivity;       /* 0.01 uS/cm at 25 degC.   */
+    int16_t  probe2_temperature;
+    uint16_t probe2_conductivity;
+    uint16_t supply_3V6;                /* mV.                      */
+    uint16_t supply_24V;
+    uint16_t supply_5V;
+    uint16_t supply_1V2;
+    uint16_t polish_current;            /* mA.                      */
+    uint16_t condensate_current;
+    uint16_t fill_current;
+    uint16_t purge_current;
+    uint16_t boost_current;
+};
+
 #endif  /* #ifndef WTS_COMMS_H */